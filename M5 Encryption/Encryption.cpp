@@ -1,106 +1,5263 @@
 // Encryption.cpp : This file contains the 'main' function. Program execution begins and ends there.
 //
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <sstream>
+#include <string_view>
+#include <thread>
 #include <ctime>
+#include <vector>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define ENCRYPTION_X86_64 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only emit wide instructions inside functions that ask for them,
+// MSVC emits whatever intrinsics are used, so the attribute is a no-op there.
+#if defined(ENCRYPTION_X86_64) && (defined(__GNUC__) || defined(__clang__))
+#define ENCRYPTION_TARGET(isa) __attribute__((target(isa)))
+#else
+#define ENCRYPTION_TARGET(isa)
+#endif
+
+/// <summary>
+/// signature shared by every xor kernel. processes length bytes of src into dst (which may be the same buffer)
+/// using the key starting at key_offset, where key_offset must be less than key_length.
+/// </summary>
+typedef void (*xor_kernel)(const char* src, char* dst, size_t length, const char* key, size_t key_length, size_t key_offset);
+
+/// <summary>
+/// portable byte at a time kernel, used for tails and on machines without a usable vector unit
+/// </summary>
+void xor_kernel_scalar(const char* src, char* dst, size_t length, const char* key, size_t key_length, size_t key_offset)
+{
+    // walk the key with a wrapping index instead of paying for a modulo on every byte
+    size_t k = key_offset;
+    for (size_t i = 0; i < length; ++i)
+    {
+        dst[i] = src[i] ^ key[k];
+        if (++k == key_length)
+        {
+            k = 0;
+        }
+    }
+}
+
+// widest register any xor kernel loads, so a key tiled this far out serves every kernel
+const size_t max_xor_vector_width = 64;
+
+/// <summary>
+/// repeats the key into tiled so that any vector_width byte window starting at a key phase can be loaded directly.
+/// the window starting at phase p is the key stream for positions with (i % key_length) == p.
+/// </summary>
+static void tile_key_into(std::vector<char>& tiled, const char* key, size_t key_length, size_t vector_width)
+{
+    tiled.resize(key_length + vector_width);
+    // whole copies of the key, then the partial copy at the end
+    size_t filled = 0;
+    for (; filled + key_length <= tiled.size(); filled += key_length)
+    {
+        std::memcpy(tiled.data() + filled, key, key_length);
+    }
+    std::memcpy(tiled.data() + filled, key, tiled.size() - filled);
+}
+
+/// <summary>
+/// tile_key_into per thread storage that is reused, so a kernel call does not allocate. the tile is
+/// only valid until the next call on the same thread.
+/// </summary>
+static const std::vector<char>& tile_key(const char* key, size_t key_length, size_t vector_width)
+{
+    thread_local std::vector<char> tiled;
+    tile_key_into(tiled, key, key_length, vector_width);
+    return tiled;
+}
+
+#if defined(ENCRYPTION_X86_64)
+// each vector kernel xors whole registers against a window of the tiled key, then advances the key
+// phase by the register width (wrapped by subtraction), and hands the remaining bytes to the scalar kernel.
+// the phase walk is identical to the scalar kernel, so output is byte for byte the same for any key length.
+// the _tiled forms take a key already tiled at least the register width out, the plain forms tile it first.
+
+ENCRYPTION_TARGET("sse2")
+void xor_kernel_sse2_tiled(const char* src, char* dst, size_t length, const char* tiled, size_t key_length, size_t key_offset)
+{
+    const size_t width = sizeof(__m128i);
+    const size_t step = width % key_length;
+    size_t phase = key_offset;
+    size_t i = 0;
+    for (; i + width <= length; i += width)
+    {
+        const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        const __m128i pad = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tiled + phase));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(data, pad));
+        phase += step;
+        if (phase >= key_length)
+        {
+            phase -= key_length;
+        }
+    }
+    xor_kernel_scalar(src + i, dst + i, length - i, tiled, key_length, phase);
+}
+
+ENCRYPTION_TARGET("sse2")
+void xor_kernel_sse2(const char* src, char* dst, size_t length, const char* key, size_t key_length, size_t key_offset)
+{
+    xor_kernel_sse2_tiled(src, dst, length, tile_key(key, key_length, sizeof(__m128i)).data(), key_length, key_offset);
+}
+
+ENCRYPTION_TARGET("avx2")
+void xor_kernel_avx2_tiled(const char* src, char* dst, size_t length, const char* tiled, size_t key_length, size_t key_offset)
+{
+    const size_t width = sizeof(__m256i);
+    const size_t step = width % key_length;
+    size_t phase = key_offset;
+    size_t i = 0;
+    for (; i + width <= length; i += width)
+    {
+        const __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        const __m256i pad = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tiled + phase));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(data, pad));
+        phase += step;
+        if (phase >= key_length)
+        {
+            phase -= key_length;
+        }
+    }
+    xor_kernel_scalar(src + i, dst + i, length - i, tiled, key_length, phase);
+}
+
+ENCRYPTION_TARGET("avx2")
+void xor_kernel_avx2(const char* src, char* dst, size_t length, const char* key, size_t key_length, size_t key_offset)
+{
+    xor_kernel_avx2_tiled(src, dst, length, tile_key(key, key_length, sizeof(__m256i)).data(), key_length, key_offset);
+}
+
+ENCRYPTION_TARGET("avx512f")
+void xor_kernel_avx512_tiled(const char* src, char* dst, size_t length, const char* tiled, size_t key_length, size_t key_offset)
+{
+    const size_t width = sizeof(__m512i);
+    const size_t step = width % key_length;
+    size_t phase = key_offset;
+    size_t i = 0;
+    for (; i + width <= length; i += width)
+    {
+        const __m512i data = _mm512_loadu_si512(src + i);
+        const __m512i pad = _mm512_loadu_si512(tiled + phase);
+        _mm512_storeu_si512(dst + i, _mm512_xor_si512(data, pad));
+        phase += step;
+        if (phase >= key_length)
+        {
+            phase -= key_length;
+        }
+    }
+    xor_kernel_scalar(src + i, dst + i, length - i, tiled, key_length, phase);
+}
+
+ENCRYPTION_TARGET("avx512f")
+void xor_kernel_avx512(const char* src, char* dst, size_t length, const char* key, size_t key_length, size_t key_offset)
+{
+    xor_kernel_avx512_tiled(src, dst, length, tile_key(key, key_length, sizeof(__m512i)).data(), key_length, key_offset);
+}
+
+/// <summary>
+/// true when both the cpu and the operating system (saved register state) support the given extension
+/// </summary>
+static bool cpu_supports(const char* isa)
+{
+#if defined(_MSC_VER)
+    int info[4] = {};
+    __cpuid(info, 0);
+    const int max_leaf = info[0];
+    __cpuid(info, 1);
+    const bool has_sse2 = (info[3] & (1 << 26)) != 0;
+    const bool has_osxsave = (info[2] & (1 << 27)) != 0;
+    const unsigned long long xcr0 = has_osxsave ? _xgetbv(0) : 0;
+    // ymm state (bits 1, 2) and zmm state (bits 5, 6, 7) must be enabled by the os
+    const bool os_ymm = (xcr0 & 0x6) == 0x6;
+    const bool os_zmm = (xcr0 & 0xE6) == 0xE6;
+    int leaf7[4] = {};
+    if (max_leaf >= 7)
+    {
+        __cpuidex(leaf7, 7, 0);
+    }
+    if (std::strcmp(isa, "sse2") == 0)
+    {
+        return has_sse2;
+    }
+    if (std::strcmp(isa, "sse4.2") == 0)
+    {
+        return (info[2] & (1 << 20)) != 0;
+    }
+    if (std::strcmp(isa, "avx2") == 0)
+    {
+        return os_ymm && (leaf7[1] & (1 << 5)) != 0;
+    }
+    if (std::strcmp(isa, "avx512f") == 0)
+    {
+        return os_zmm && (leaf7[1] & (1 << 16)) != 0;
+    }
+    return false;
+#else
+    __builtin_cpu_init();
+    if (std::strcmp(isa, "sse2") == 0)
+    {
+        return __builtin_cpu_supports("sse2");
+    }
+    if (std::strcmp(isa, "sse4.2") == 0)
+    {
+        return __builtin_cpu_supports("sse4.2");
+    }
+    if (std::strcmp(isa, "avx2") == 0)
+    {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (std::strcmp(isa, "avx512f") == 0)
+    {
+        return __builtin_cpu_supports("avx512f");
+    }
+    return false;
+#endif
+}
+#endif
+
+// kernels specialized at compile time for keys whose length divides 64. the key stream then repeats
+// every 64 bytes, so a 64 byte pattern is built once per call and every block is whole word or whole
+// register xors against it, with no modulo and no key phase to track.
+const size_t fixed_key_block = 64;
+
+/// <summary>
+/// the key stream for one 64 byte block starting at key_offset
+/// </summary>
+template <size_t KeyLength>
+inline void fill_key_pattern(char* pattern, const char* key, size_t key_offset)
+{
+    static_assert(KeyLength > 0 && fixed_key_block % KeyLength == 0, "the key must tile a 64 byte block exactly");
+    for (size_t j = 0; j < fixed_key_block; ++j)
+    {
+        pattern[j] = key[(key_offset + j) % KeyLength];
+    }
+}
+
+/// <summary>
+/// xor the bytes after the last whole block. position i of the input always uses pattern byte i % 64.
+/// </summary>
+inline void xor_fixed_tail(const char* src, char* dst, size_t begin, size_t length, const char* pattern)
+{
+    for (size_t i = begin; i < length; ++i)
+    {
+        dst[i] = src[i] ^ pattern[i % fixed_key_block];
+    }
+}
+
+template <size_t KeyLength>
+void xor_kernel_fixed_scalar(const char* src, char* dst, size_t length, const char* key, size_t key_length, size_t key_offset)
+{
+    assert(key_length == KeyLength);
+    (void)key_length;
+
+    alignas(64) char pattern[fixed_key_block];
+    fill_key_pattern<KeyLength>(pattern, key, key_offset);
+    uint64_t words[fixed_key_block / 8];
+    std::memcpy(words, pattern, sizeof(words));
+
+    size_t i = 0;
+    for (; i + fixed_key_block <= length; i += fixed_key_block)
+    {
+        for (size_t w = 0; w < fixed_key_block / 8; ++w)
+        {
+            uint64_t value;
+            std::memcpy(&value, src + i + w * 8, 8);
+            value ^= words[w];
+            std::memcpy(dst + i + w * 8, &value, 8);
+        }
+    }
+    xor_fixed_tail(src, dst, i, length, pattern);
+}
+
+#if defined(ENCRYPTION_X86_64)
+template <size_t KeyLength>
+ENCRYPTION_TARGET("sse2")
+void xor_kernel_fixed_sse2(const char* src, char* dst, size_t length, const char* key, size_t key_length, size_t key_offset)
+{
+    assert(key_length == KeyLength);
+    (void)key_length;
+
+    alignas(64) char pattern[fixed_key_block];
+    fill_key_pattern<KeyLength>(pattern, key, key_offset);
+    __m128i pad[4];
+    for (int r = 0; r < 4; ++r)
+    {
+        pad[r] = _mm_load_si128(reinterpret_cast<const __m128i*>(pattern) + r);
+    }
+
+    size_t i = 0;
+    for (; i + fixed_key_block <= length; i += fixed_key_block)
+    {
+        for (int r = 0; r < 4; ++r)
+        {
+            const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i) + r);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i) + r, _mm_xor_si128(data, pad[r]));
+        }
+    }
+    xor_fixed_tail(src, dst, i, length, pattern);
+}
+
+template <size_t KeyLength>
+ENCRYPTION_TARGET("avx2")
+void xor_kernel_fixed_avx2(const char* src, char* dst, size_t length, const char* key, size_t key_length, size_t key_offset)
+{
+    assert(key_length == KeyLength);
+    (void)key_length;
+
+    alignas(64) char pattern[fixed_key_block];
+    fill_key_pattern<KeyLength>(pattern, key, key_offset);
+    const __m256i pad0 = _mm256_load_si256(reinterpret_cast<const __m256i*>(pattern));
+    const __m256i pad1 = _mm256_load_si256(reinterpret_cast<const __m256i*>(pattern) + 1);
+
+    size_t i = 0;
+    for (; i + fixed_key_block <= length; i += fixed_key_block)
+    {
+        const __m256i data0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        const __m256i data1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i) + 1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(data0, pad0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i) + 1, _mm256_xor_si256(data1, pad1));
+    }
+    xor_fixed_tail(src, dst, i, length, pattern);
+}
+
+template <size_t KeyLength>
+ENCRYPTION_TARGET("avx512f")
+void xor_kernel_fixed_avx512(const char* src, char* dst, size_t length, const char* key, size_t key_length, size_t key_offset)
+{
+    assert(key_length == KeyLength);
+    (void)key_length;
+
+    alignas(64) char pattern[fixed_key_block];
+    fill_key_pattern<KeyLength>(pattern, key, key_offset);
+    const __m512i pad = _mm512_load_si512(pattern);
+
+    size_t i = 0;
+    for (; i + fixed_key_block <= length; i += fixed_key_block)
+    {
+        _mm512_storeu_si512(dst + i, _mm512_xor_si512(_mm512_loadu_si512(src + i), pad));
+    }
+    xor_fixed_tail(src, dst, i, length, pattern);
+}
+#endif
+
+/// <summary>
+/// the kernels xor_transform chooses between: one per supported fixed key length, and the generic
+/// kernel for every other length
+/// </summary>
+struct xor_kernel_set
+{
+    const char* name = "scalar";
+    xor_kernel generic = xor_kernel_scalar;
+    xor_kernel tiled = xor_kernel_scalar;
+    xor_kernel fixed[fixed_key_block + 1] = {};
+};
+
+// fill the fixed key length entries of a kernel table from one kernel template
+#define ENCRYPTION_FIXED_XOR_KERNELS(table, kernel) \
+    table[1] = kernel<1>; table[2] = kernel<2>; table[4] = kernel<4>; table[8] = kernel<8>; \
+    table[16] = kernel<16>; table[32] = kernel<32>; table[64] = kernel<64>;
+
+/// <summary>
+/// picks the widest kernels this machine can run. resolved once and cached by xor_transform.
+/// </summary>
+xor_kernel_set select_xor_kernels()
+{
+    xor_kernel_set kernels;
+    ENCRYPTION_FIXED_XOR_KERNELS(kernels.fixed, xor_kernel_fixed_scalar);
+#if defined(ENCRYPTION_X86_64)
+    if (cpu_supports("avx512f"))
+    {
+        kernels.name = "avx512";
+        kernels.generic = xor_kernel_avx512;
+        kernels.tiled = xor_kernel_avx512_tiled;
+        ENCRYPTION_FIXED_XOR_KERNELS(kernels.fixed, xor_kernel_fixed_avx512);
+    }
+    else if (cpu_supports("avx2"))
+    {
+        kernels.name = "avx2";
+        kernels.generic = xor_kernel_avx2;
+        kernels.tiled = xor_kernel_avx2_tiled;
+        ENCRYPTION_FIXED_XOR_KERNELS(kernels.fixed, xor_kernel_fixed_avx2);
+    }
+    else if (cpu_supports("sse2"))
+    {
+        kernels.name = "sse2";
+        kernels.generic = xor_kernel_sse2;
+        kernels.tiled = xor_kernel_sse2_tiled;
+        ENCRYPTION_FIXED_XOR_KERNELS(kernels.fixed, xor_kernel_fixed_sse2);
+    }
+#endif
+    return kernels;
+}
+
+/// <summary>
+/// the generic kernel select_xor_kernels picks for this machine, which handles any key length
+/// </summary>
+/// <param name="name">receives a printable name of the chosen kernel, may be null</param>
+/// <returns>the kernel to use</returns>
+xor_kernel select_xor_kernel(const char** name)
+{
+    const xor_kernel_set kernels = select_xor_kernels();
+    if (name != nullptr)
+    {
+        *name = kernels.name;
+    }
+    return kernels.generic;
+}
+
+/// <summary>
+/// xor length bytes of src into dst with the repeating key, starting at key position key_offset.
+/// dst may alias src for an in place transform. keys of 1, 2, 4, 8, 16, 32 or 64 bytes run a kernel
+/// specialized for that length, any other length runs the generic kernel.
+/// </summary>
+/// <param name="src">input bytes</param>
+/// <param name="dst">output bytes, at least length long</param>
+/// <param name="length">number of bytes to process</param>
+/// <param name="key">key bytes</param>
+/// <param name="key_length">number of key bytes, must be greater than zero</param>
+/// <param name="key_offset">key position of the first byte, usually the stream position modulo key_length</param>
+void xor_transform(const char* src, char* dst, size_t length, const char* key, size_t key_length, size_t key_offset)
+{
+    assert(key_length > 0);
+    assert(key_offset < key_length);
+
+    static const xor_kernel_set kernels = select_xor_kernels();
+    const xor_kernel fixed = key_length <= fixed_key_block ? kernels.fixed[key_length] : nullptr;
+    (fixed != nullptr ? fixed : kernels.generic)(src, dst, length, key, key_length, key_offset);
+}
+
+/// <summary>
+/// xor_transform for a key already tiled by tile_key_into out to key_length + max_xor_vector_width bytes,
+/// so a caller applying the same long key to many small blocks pays for the tiling once rather than per block
+/// </summary>
+void xor_transform_tiled(const char* src, char* dst, size_t length, const char* tiled, size_t key_length, size_t key_offset)
+{
+    assert(key_length > 0);
+    assert(key_offset < key_length);
+
+    static const xor_kernel_set kernels = select_xor_kernels();
+    const xor_kernel fixed = key_length <= fixed_key_block ? kernels.fixed[key_length] : nullptr;
+    (fixed != nullptr ? fixed : kernels.tiled)(src, dst, length, tiled, key_length, key_offset);
+}
+
+// CRC32C (Castagnoli polynomial), the checksum recorded by the container format. the sse4.2 crc32
+// instruction computes exactly this polynomial; the table version is used everywhere else.
+const uint32_t crc32c_polynomial = 0x82F63B78;
+
+/// <summary>
+/// signature of the crc32c kernels. crc is a finished crc of the bytes so far (zero to start), so
+/// results chain: crc32c(crc32c(0, a), b) == crc32c(0, a + b)
+/// </summary>
+typedef uint32_t (*crc32c_kernel)(uint32_t crc, const char* data, size_t length);
+
+uint32_t crc32c_scalar(uint32_t crc, const char* data, size_t length)
+{
+    struct crc32c_table
+    {
+        uint32_t entries[256];
+        crc32c_table()
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t value = i;
+                for (int bit = 0; bit < 8; ++bit)
+                {
+                    value = (value >> 1) ^ ((value & 1) ? crc32c_polynomial : 0);
+                }
+                entries[i] = value;
+            }
+        }
+    };
+    static const crc32c_table table;
+
+    crc = ~crc;
+    for (size_t i = 0; i < length; ++i)
+    {
+        crc = (crc >> 8) ^ table.entries[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF];
+    }
+    return ~crc;
+}
+
+#if defined(ENCRYPTION_X86_64)
+ENCRYPTION_TARGET("sse4.2")
+uint32_t crc32c_sse42(uint32_t crc, const char* data, size_t length)
+{
+    uint64_t value = ~crc & 0xFFFFFFFFu;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        value = _mm_crc32_u64(value, word);
+    }
+    uint32_t tail = static_cast<uint32_t>(value);
+    for (; i < length; ++i)
+    {
+        tail = _mm_crc32_u8(tail, static_cast<unsigned char>(data[i]));
+    }
+    return ~tail;
+}
+#endif
+
+/// <summary>
+/// extend a crc32c with length more bytes, using the crc32 instruction when the cpu has it
+/// </summary>
+uint32_t crc32c(uint32_t crc, const char* data, size_t length)
+{
+#if defined(ENCRYPTION_X86_64)
+    static const crc32c_kernel kernel = cpu_supports("sse4.2") ? crc32c_sse42 : crc32c_scalar;
+#else
+    static const crc32c_kernel kernel = crc32c_scalar;
+#endif
+    return kernel(crc, data, length);
+}
+
+// bytes transformed between checksum updates in the fused pass. source and result blocks both stay in L1,
+// so the checksums read them from cache instead of making a second trip to memory.
+const size_t fused_block_size = 4096;
+
+/// <summary>
+/// xor_transform that also extends a crc32c of the input and of the output in the same pass.
+/// dst may alias src.
+/// </summary>
+/// <param name="src_crc">crc of the input so far, extended with src</param>
+/// <param name="dst_crc">crc of the output so far, extended with dst</param>
+void xor_transform_checksum(const char* src, char* dst, size_t length, const char* key, size_t key_length, size_t key_offset, uint32_t& src_crc, uint32_t& dst_crc)
+{
+    assert(key_length > 0);
+    assert(key_offset < key_length);
+
+    for (size_t i = 0; i < length; i += fused_block_size)
+    {
+        const size_t count = std::min(fused_block_size, length - i);
+        // checksum the input before an in place transform overwrites it
+        src_crc = crc32c(src_crc, src + i, count);
+        xor_transform(src + i, dst + i, count, key, key_length, key_offset);
+        dst_crc = crc32c(dst_crc, dst + i, count);
+        key_offset = (key_offset + count % key_length) % key_length;
+    }
+}
+
+/// <summary>
+/// fixed set of worker threads pulling tasks from a shared queue
+/// </summary>
+class thread_pool
+{
+public:
+    /// <param name="thread_count">number of workers, zero means one per hardware thread</param>
+    explicit thread_pool(size_t thread_count = 0)
+    {
+        if (thread_count == 0)
+        {
+            thread_count = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (size_t i = 0; i < thread_count; ++i)
+        {
+            workers_.emplace_back([this]() { worker_loop(); });
+        }
+    }
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        ready_.notify_all();
+        for (auto& worker : workers_)
+        {
+            worker.join();
+        }
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    size_t size() const { return workers_.size(); }
+
+    /// <summary>
+    /// queue a task to run on one of the workers
+    /// </summary>
+    void submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.push_back(std::move(task));
+        }
+        ready_.notify_one();
+    }
+
+    /// <summary>
+    /// call body(i) for every i in [0, count) and return when all calls are done.
+    /// the calling thread takes items too, and workers that only get to run after the items are
+    /// used up are not waited for, so this is safe to call from inside a task on the same pool.
+    /// the first exception thrown by body is rethrown here.
+    /// </summary>
+    void parallel_for(size_t count, const std::function<void(size_t)>& body)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+
+        struct shared_state
+        {
+            std::atomic<size_t> next{ 0 };
+            size_t count = 0;
+            const std::function<void(size_t)>* body = nullptr;
+            std::mutex mutex;
+            std::condition_variable finished;
+            size_t running = 0;
+            std::exception_ptr error;
+
+            void drain()
+            {
+                try
+                {
+                    for (size_t i = next++; i < count; i = next++)
+                    {
+                        (*body)(i);
+                    }
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!error)
+                    {
+                        error = std::current_exception();
+                    }
+                    next = count;
+                }
+            }
+        };
+
+        auto state = std::make_shared<shared_state>();
+        state->count = count;
+        state->body = &body;
+
+        const size_t helpers = std::min(workers_.size(), count - 1);
+        for (size_t h = 0; h < helpers; ++h)
+        {
+            submit([state]() {
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    if (state->next >= state->count)
+                    { // the caller already finished, body may be gone
+                        return;
+                    }
+                    ++state->running;
+                }
+                state->drain();
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (--state->running == 0)
+                {
+                    state->finished.notify_all();
+                }
+            });
+        }
+
+        state->drain();
+
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->finished.wait(lock, [&state]() { return state->running == 0; });
+        if (state->error)
+        {
+            std::rethrow_exception(state->error);
+        }
+    }
+
+private:
+    void worker_loop()
+    {
+        for (;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                ready_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+                if (tasks_.empty())
+                { // stopping and nothing left to do
+                    return;
+                }
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    bool stopping_ = false;
+};
+
+/// <summary>
+/// the pool shared by the parallel paths, one worker per hardware thread, created on first use
+/// </summary>
+thread_pool& default_thread_pool()
+{
+    static thread_pool pool;
+    return pool;
+}
+
+// bytes handed to a worker at a time. small enough to stay in L2 and to balance well,
+// large enough that scheduling is noise next to the xor itself.
+const size_t parallel_chunk_size = 256 * 1024;
+
+/// <summary>
+/// xor_transform split across the pool. each chunk starts at its own key phase, so the result
+/// is byte for byte the same as the serial call.
+/// </summary>
+void parallel_xor_transform(const char* src, char* dst, size_t length, const char* key, size_t key_length, size_t key_offset, thread_pool& pool)
+{
+    assert(key_length > 0);
+    assert(key_offset < key_length);
+
+    const size_t chunk_count = (length + parallel_chunk_size - 1) / parallel_chunk_size;
+    if (chunk_count < 2 || pool.size() < 2)
+    { // not worth waking anyone up
+        xor_transform(src, dst, length, key, key_length, key_offset);
+        return;
+    }
+
+    pool.parallel_for(chunk_count, [=](size_t chunk) {
+        const size_t begin = chunk * parallel_chunk_size;
+        const size_t count = std::min(parallel_chunk_size, length - begin);
+        const size_t chunk_key_offset = (key_offset + begin % key_length) % key_length;
+        xor_transform(src + begin, dst + begin, count, key, key_length, chunk_key_offset);
+    });
+}
+
+// source bytes taken per step of the fan out. the block and the matching output block of the key being
+// applied stay inside L1, so the source is read from memory once no matter how many keys there are.
+const size_t fan_out_block_size = 8 * 1024;
+
+/// <summary>
+/// xor one source against many keys in a single pass over it. each source block is transformed under
+/// every key while it is still in L1, rather than the whole source being walked again per key.
+/// runs of parallel_chunk_size bytes are spread over the pool. every output starts at key phase zero.
+/// </summary>
+/// <param name="src">bytes to transform</param>
+/// <param name="length">number of bytes</param>
+/// <param name="keys">key_count non empty keys</param>
+/// <param name="outputs">key_count buffers of length bytes, outputs[k] receives src under keys[k]</param>
+/// <param name="key_count">number of keys</param>
+/// <param name="pool">workers to use</param>
+/// <returns>false, with nothing transformed, when any key is empty</returns>
+bool xor_transform_fan_out(const char* src, size_t length, const std::string* keys, char* const* outputs, size_t key_count, thread_pool& pool)
+{
+    for (size_t k = 0; k < key_count; ++k)
+    {
+        if (keys[k].empty())
+        {
+            return false;
+        }
+    }
+
+    // every key is tiled once here, not once per block by the kernel, which matters for long keys
+    std::vector<std::vector<char>> tiled_keys(key_count);
+    for (size_t k = 0; k < key_count; ++k)
+    {
+        tile_key_into(tiled_keys[k], keys[k].data(), keys[k].length(), max_xor_vector_width);
+    }
+
+    auto transform_run = [&](size_t begin, size_t end) {
+        for (size_t block = begin; block < end; block += fan_out_block_size)
+        {
+            const size_t count = std::min(fan_out_block_size, end - block);
+            for (size_t k = 0; k < key_count; ++k)
+            {
+                xor_transform_tiled(src + block, outputs[k] + block, count, tiled_keys[k].data(), keys[k].length(), block % keys[k].length());
+            }
+        }
+    };
+
+    const size_t chunk_count = (length + parallel_chunk_size - 1) / parallel_chunk_size;
+    if (chunk_count < 2 || pool.size() < 2)
+    {
+        transform_run(0, length);
+        return true;
+    }
+    pool.parallel_for(chunk_count, [=](size_t chunk) {
+        const size_t begin = chunk * parallel_chunk_size;
+        transform_run(begin, std::min(length, begin + parallel_chunk_size));
+    });
+    return true;
+}
+
+/// <summary>
+/// encrypt or decrypt a source string under each of several keys with one pass over the source
+/// </summary>
+/// <param name="source">input string to process</param>
+/// <param name="keys">keys to use, none empty</param>
+/// <param name="outputs">receives one transformed string per key, in the order of keys</param>
+/// <returns>false when any key is empty</returns>
+bool encrypt_decrypt_fan_out(const std::string& source, const std::vector<std::string>& keys, std::vector<std::string>& outputs)
+{
+    outputs.assign(keys.size(), std::string(source.length(), '\0'));
+    std::vector<char*> output_data(keys.size());
+    for (size_t k = 0; k < keys.size(); ++k)
+    {
+        output_data[k] = &outputs[k][0];
+    }
+    return xor_transform_fan_out(source.data(), source.length(), keys.data(), output_data.data(), keys.size(), default_thread_pool());
+}
+
+/// <summary>
+/// a keyed stream cipher behind a common interface, so encrypt_decrypt can run any backend.
+/// every backend is position addressable: transforming at a position gives the same bytes as
+/// transforming the whole stream from zero and taking that slice.
+/// </summary>
+class cipher_engine
+{
+public:
+    virtual ~cipher_engine() = default;
+
+    /// <summary>
+    /// printable backend name
+    /// </summary>
+    virtual const char* name() const = 0;
+
+    /// <summary>
+    /// encrypt or decrypt length bytes of src into dst (which may be the same buffer), where src[0]
+    /// sits at the given byte position of the stream
+    /// </summary>
+    /// <returns>false, leaving dst untouched, when the range lies beyond the end of the cipher's stream</returns>
+    virtual bool transform(const char* src, char* dst, size_t length, uint64_t position) const = 0;
+
+    /// <summary>
+    /// time repeated in place transforms of a buffer and report the rate, so backends can be compared
+    /// through the same call
+    /// </summary>
+    /// <param name="bytes">buffer size</param>
+    /// <param name="iterations">passes over the buffer</param>
+    /// <returns>throughput in GB/s</returns>
+    double measure_throughput(size_t bytes, int iterations) const
+    {
+        std::vector<char> buffer(bytes, 'x');
+        if (!transform(buffer.data(), buffer.data(), buffer.size(), 0))   // warm up caches and page in the buffer
+        {
+            return 0.0;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+        {
+            transform(buffer.data(), buffer.data(), buffer.size(), 0);
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return seconds > 0.0 ? static_cast<double>(bytes) * iterations / seconds / 1.0e9 : 0.0;
+    }
+};
+
+/// <summary>
+/// the original repeating key xor as a cipher engine
+/// </summary>
+class xor_cipher : public cipher_engine
+{
+public:
+    explicit xor_cipher(const std::string& key)
+        : key_(key)
+    {
+        assert(!key_.empty());
+    }
+
+    const char* name() const override { return "xor"; }
+
+    bool transform(const char* src, char* dst, size_t length, uint64_t position) const override
+    {
+        xor_transform(src, dst, length, key_.data(), key_.length(), static_cast<size_t>(position % key_.length()));
+        return true;
+    }
+
+private:
+    std::string key_;
+};
+
+/// <summary>
+/// which cipher engine encrypt_decrypt and the stream, pipeline and mmap modes run, set by --cipher before the mode
+/// </summary>
+struct cipher_settings
+{
+    std::string name = "xor";
+};
+
+cipher_settings& default_cipher_settings()
+{
+    static cipher_settings settings;
+    return settings;
+}
+
+std::unique_ptr<cipher_engine> make_cipher_engine(const std::string& key);
+
+/// <summary>
+/// encrypt or decrypt a source string using the provided key
+/// </summary>
+/// <param name="source">input string to process</param>
+/// <param name="key">key to use in encryption / decryption</param>
+/// <returns>transformed string</returns>
+std::string encrypt_decrypt(const std::string& source, const std::string& key)
+{
+    // get lengths now instead of calling the function every time.
+    // this would have most likely been inlined by the compiler, but design for perfomance.
+    const auto key_length = key.length();
+    const auto source_length = source.length();
+
+    // assert that our input data is good
+    assert(key_length > 0);
+    assert(source_length > 0);
+
+    std::string output = source;
+
+    // transform each character through the selected cipher engine. the default xor engine's
+    // vectorized kernel gives the same result as output[i] = source[i] ^ key[i % key_length]
+    const std::unique_ptr<cipher_engine> engine = make_cipher_engine(key);
+    if (engine == nullptr || !engine->transform(source.data(), &output[0], source_length, 0))
+    { // the key does not suit the selected cipher, or the source runs past the end of its stream
+        output.clear();
+    }
+
+    // our output length must equal our source length
+    assert(output.length() == source_length);
+
+    // return the transformed string
+    return output;
+}
+
+/// <summary>
+/// encrypt or decrypt a source string using the provided key, spread across all cores.
+/// same result as encrypt_decrypt.
+/// </summary>
+/// <param name="source">input string to process</param>
+/// <param name="key">key to use in encryption / decryption</param>
+/// <returns>transformed string</returns>
+std::string parallel_encrypt_decrypt(const std::string& source, const std::string& key)
+{
+    assert(key.length() > 0);
+
+    std::string output(source.length(), '\0');
+    parallel_xor_transform(source.data(), &output[0], source.length(), key.data(), key.length(), 0, default_thread_pool());
+    return output;
+}
+
+// ChaCha20 as specified in RFC 8439: 256 bit key, 96 bit nonce, 32 bit block counter, 64 byte blocks
+const size_t chacha20_key_size = 32;
+const size_t chacha20_nonce_size = 12;
+const size_t chacha20_block_size = 64;
+
+inline uint32_t rotl32(uint32_t value, int bits)
+{
+    return (value << bits) | (value >> (32 - bits));
+}
+
+inline void chacha20_quarter_round(uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d)
+{
+    a += b; d ^= a; d = rotl32(d, 16);
+    c += d; b ^= c; b = rotl32(b, 12);
+    a += b; d ^= a; d = rotl32(d, 8);
+    c += d; b ^= c; b = rotl32(b, 7);
+}
+
+inline void store_le32(char* out, uint32_t value)
+{
+    out[0] = static_cast<char>(value & 0xFF);
+    out[1] = static_cast<char>((value >> 8) & 0xFF);
+    out[2] = static_cast<char>((value >> 16) & 0xFF);
+    out[3] = static_cast<char>((value >> 24) & 0xFF);
+}
+
+/// <summary>
+/// signature shared by the chacha20 keystream kernels. writes blocks * 64 bytes of keystream for the
+/// counters starting at state[12]. every kernel gives the same bytes, the vector ones just do several blocks at once.
+/// </summary>
+typedef void (*chacha20_kernel)(const uint32_t state[16], size_t blocks, char* keystream);
+
+void chacha20_keystream_scalar(const uint32_t state[16], size_t blocks, char* keystream)
+{
+    for (size_t block = 0; block < blocks; ++block)
+    {
+        uint32_t x[16];
+        std::memcpy(x, state, sizeof(x));
+        x[12] += static_cast<uint32_t>(block);
+        const uint32_t counter = x[12];
+
+        // 20 rounds: 10 column rounds interleaved with 10 diagonal rounds
+        for (int round = 0; round < 10; ++round)
+        {
+            chacha20_quarter_round(x[0], x[4], x[8], x[12]);
+            chacha20_quarter_round(x[1], x[5], x[9], x[13]);
+            chacha20_quarter_round(x[2], x[6], x[10], x[14]);
+            chacha20_quarter_round(x[3], x[7], x[11], x[15]);
+            chacha20_quarter_round(x[0], x[5], x[10], x[15]);
+            chacha20_quarter_round(x[1], x[6], x[11], x[12]);
+            chacha20_quarter_round(x[2], x[7], x[8], x[13]);
+            chacha20_quarter_round(x[3], x[4], x[9], x[14]);
+        }
+
+        for (int i = 0; i < 16; ++i)
+        {
+            const uint32_t input = i == 12 ? counter : state[i];
+            store_le32(keystream + block * chacha20_block_size + i * 4, x[i] + input);
+        }
+    }
+}
+
+#if defined(ENCRYPTION_X86_64)
+// the vector kernels keep one state word per register with one block per lane, so a quarter round on
+// registers is a quarter round on 4 (sse2) or 8 (avx2) blocks at once. the result is transposed back
+// to block order before it is stored. x86 is little endian, so words are stored as they are.
+
+#define CHACHA20_SSE2_ROTL(v, bits) _mm_or_si128(_mm_slli_epi32((v), (bits)), _mm_srli_epi32((v), 32 - (bits)))
+#define CHACHA20_SSE2_QUARTER_ROUND(a, b, c, d) \
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = CHACHA20_SSE2_ROTL(d, 16); \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = CHACHA20_SSE2_ROTL(b, 12); \
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = CHACHA20_SSE2_ROTL(d, 8); \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = CHACHA20_SSE2_ROTL(b, 7);
+
+ENCRYPTION_TARGET("sse2")
+void chacha20_keystream_sse2(const uint32_t state[16], size_t blocks, char* keystream)
+{
+    const size_t lanes = 4;
+    size_t block = 0;
+    for (; block + lanes <= blocks; block += lanes)
+    {
+        __m128i input[16];
+        for (int i = 0; i < 16; ++i)
+        {
+            input[i] = _mm_set1_epi32(static_cast<int>(state[i]));
+        }
+        const uint32_t counter = state[12] + static_cast<uint32_t>(block);
+        input[12] = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(counter)), _mm_set_epi32(3, 2, 1, 0));
+
+        __m128i x[16];
+        for (int i = 0; i < 16; ++i)
+        {
+            x[i] = input[i];
+        }
+        for (int round = 0; round < 10; ++round)
+        {
+            CHACHA20_SSE2_QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+            CHACHA20_SSE2_QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+            CHACHA20_SSE2_QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+            CHACHA20_SSE2_QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+            CHACHA20_SSE2_QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+            CHACHA20_SSE2_QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+            CHACHA20_SSE2_QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+            CHACHA20_SSE2_QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+        }
+        for (int i = 0; i < 16; ++i)
+        {
+            x[i] = _mm_add_epi32(x[i], input[i]);
+        }
+
+        // transpose each group of four words so one register holds 16 consecutive bytes of one block
+        char* out = keystream + block * chacha20_block_size;
+        for (int group = 0; group < 4; ++group)
+        {
+            const __m128i* w = x + group * 4;
+            const __m128i t0 = _mm_unpacklo_epi32(w[0], w[1]);
+            const __m128i t1 = _mm_unpacklo_epi32(w[2], w[3]);
+            const __m128i t2 = _mm_unpackhi_epi32(w[0], w[1]);
+            const __m128i t3 = _mm_unpackhi_epi32(w[2], w[3]);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 0 * chacha20_block_size + group * 16), _mm_unpacklo_epi64(t0, t1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 1 * chacha20_block_size + group * 16), _mm_unpackhi_epi64(t0, t1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * chacha20_block_size + group * 16), _mm_unpacklo_epi64(t2, t3));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 3 * chacha20_block_size + group * 16), _mm_unpackhi_epi64(t2, t3));
+        }
+    }
+
+    if (block < blocks)
+    {
+        uint32_t tail_state[16];
+        std::memcpy(tail_state, state, sizeof(tail_state));
+        tail_state[12] += static_cast<uint32_t>(block);
+        chacha20_keystream_scalar(tail_state, blocks - block, keystream + block * chacha20_block_size);
+    }
+}
+
+// avx2 has byte shuffles, which rotate by 16 and 8 in one instruction
+#define CHACHA20_AVX2_ROTL(v, bits) _mm256_or_si256(_mm256_slli_epi32((v), (bits)), _mm256_srli_epi32((v), 32 - (bits)))
+#define CHACHA20_AVX2_QUARTER_ROUND(a, b, c, d) \
+    a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rotate16); \
+    c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = CHACHA20_AVX2_ROTL(b, 12); \
+    a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rotate8); \
+    c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = CHACHA20_AVX2_ROTL(b, 7);
+
+ENCRYPTION_TARGET("avx2")
+void chacha20_keystream_avx2(const uint32_t state[16], size_t blocks, char* keystream)
+{
+    const size_t lanes = 8;
+    const __m256i rotate16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+        2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rotate8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+        3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+
+    size_t block = 0;
+    for (; block + lanes <= blocks; block += lanes)
+    {
+        __m256i input[16];
+        for (int i = 0; i < 16; ++i)
+        {
+            input[i] = _mm256_set1_epi32(static_cast<int>(state[i]));
+        }
+        const uint32_t counter = state[12] + static_cast<uint32_t>(block);
+        input[12] = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(counter)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+        __m256i x[16];
+        for (int i = 0; i < 16; ++i)
+        {
+            x[i] = input[i];
+        }
+        for (int round = 0; round < 10; ++round)
+        {
+            CHACHA20_AVX2_QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+            CHACHA20_AVX2_QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+            CHACHA20_AVX2_QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+            CHACHA20_AVX2_QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+            CHACHA20_AVX2_QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+            CHACHA20_AVX2_QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+            CHACHA20_AVX2_QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+            CHACHA20_AVX2_QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+        }
+        for (int i = 0; i < 16; ++i)
+        {
+            x[i] = _mm256_add_epi32(x[i], input[i]);
+        }
+
+        // unpack works inside each 128 bit half, so after the 4x4 transpose the low half of a register
+        // holds 16 bytes of block b and the high half the same 16 bytes of block b + 4
+        char* out = keystream + block * chacha20_block_size;
+        for (int group = 0; group < 4; ++group)
+        {
+            const __m256i* w = x + group * 4;
+            const __m256i t0 = _mm256_unpacklo_epi32(w[0], w[1]);
+            const __m256i t1 = _mm256_unpacklo_epi32(w[2], w[3]);
+            const __m256i t2 = _mm256_unpackhi_epi32(w[0], w[1]);
+            const __m256i t3 = _mm256_unpackhi_epi32(w[2], w[3]);
+            const __m256i rows[4] = {
+                _mm256_unpacklo_epi64(t0, t1),
+                _mm256_unpackhi_epi64(t0, t1),
+                _mm256_unpacklo_epi64(t2, t3),
+                _mm256_unpackhi_epi64(t2, t3),
+            };
+            for (int b = 0; b < 4; ++b)
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + b * chacha20_block_size + group * 16), _mm256_castsi256_si128(rows[b]));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + (b + 4) * chacha20_block_size + group * 16), _mm256_extracti128_si256(rows[b], 1));
+            }
+        }
+    }
+
+    if (block < blocks)
+    { // fewer than eight blocks left, the four wide kernel can still take most of them
+        uint32_t tail_state[16];
+        std::memcpy(tail_state, state, sizeof(tail_state));
+        tail_state[12] += static_cast<uint32_t>(block);
+        chacha20_keystream_sse2(tail_state, blocks - block, keystream + block * chacha20_block_size);
+    }
+}
+#endif
+
+/// <summary>
+/// picks the widest chacha20 kernel this machine can run
+/// </summary>
+/// <param name="name">receives a printable name of the chosen kernel, may be null</param>
+chacha20_kernel select_chacha20_kernel(const char** name)
+{
+    const char* chosen = "scalar";
+    chacha20_kernel kernel = chacha20_keystream_scalar;
+#if defined(ENCRYPTION_X86_64)
+    if (cpu_supports("avx2"))
+    {
+        chosen = "avx2";
+        kernel = chacha20_keystream_avx2;
+    }
+    else if (cpu_supports("sse2"))
+    {
+        chosen = "sse2";
+        kernel = chacha20_keystream_sse2;
+    }
+#endif
+    if (name != nullptr)
+    {
+        *name = chosen;
+    }
+    return kernel;
+}
+
+/// <summary>
+/// ChaCha20 (RFC 8439) as a cipher engine
+/// </summary>
+class chacha20_cipher : public cipher_engine
+{
+public:
+    /// <param name="key">32 byte key</param>
+    /// <param name="nonce">12 byte nonce, must never repeat for the same key</param>
+    /// <param name="initial_counter">block counter of stream position zero</param>
+    /// <param name="kernel">keystream kernel, null picks the widest the machine supports</param>
+    chacha20_cipher(const unsigned char* key, const unsigned char* nonce, uint32_t initial_counter, chacha20_kernel kernel = nullptr)
+        : kernel_(kernel != nullptr ? kernel : select_chacha20_kernel(nullptr))
+    {
+        // "expand 32-byte k"
+        state_[0] = 0x61707865;
+        state_[1] = 0x3320646e;
+        state_[2] = 0x79622d32;
+        state_[3] = 0x6b206574;
+        for (int i = 0; i < 8; ++i)
+        {
+            state_[4 + i] = load_le32(key + i * 4);
+        }
+        state_[12] = initial_counter;
+        for (int i = 0; i < 3; ++i)
+        {
+            state_[13 + i] = load_le32(nonce + i * 4);
+        }
+    }
+
+    const char* name() const override { return "chacha20"; }
+
+    bool transform(const char* src, char* dst, size_t length, uint64_t position) const override
+    {
+        // keystream is made a batch of blocks at a time so the vector kernels always have full groups
+        const size_t batch_blocks = 64;
+        alignas(64) char keystream[batch_blocks * chacha20_block_size];
+
+        uint32_t state[16];
+        std::memcpy(state, state_, sizeof(state));
+
+        // the block holding the first byte, and where in that block it falls
+        const uint64_t first_block = position / chacha20_block_size;
+        size_t skip = static_cast<size_t>(position % chacha20_block_size);
+
+        // the 32 bit block counter must not wrap: that would reuse keystream, and xoring two ciphertexts
+        // made with the same keystream gives away the xor of their plaintexts
+        const uint64_t blocks_left = 0x100000000ull - state_[12];
+        const uint64_t blocks_needed = length / chacha20_block_size + (skip + length % chacha20_block_size + chacha20_block_size - 1) / chacha20_block_size;
+        if (first_block > blocks_left || blocks_needed > blocks_left - first_block)
+        {
+            return false;
+        }
+        state[12] += static_cast<uint32_t>(first_block);
+
+        size_t done = 0;
+        while (done < length)
+        {
+            const size_t wanted = skip + (length - done);
+            const size_t blocks = std::min(batch_blocks, (wanted + chacha20_block_size - 1) / chacha20_block_size);
+            kernel_(state, blocks, keystream);
+            state[12] += static_cast<uint32_t>(blocks);
+
+            const size_t count = std::min(blocks * chacha20_block_size - skip, length - done);
+            for (size_t i = 0; i < count; ++i)
+            {
+                dst[done + i] = src[done + i] ^ keystream[skip + i];
+            }
+            done += count;
+            skip = 0;
+        }
+        return true;
+    }
+
+private:
+    static uint32_t load_le32(const unsigned char* in)
+    {
+        return static_cast<uint32_t>(in[0]) | (static_cast<uint32_t>(in[1]) << 8) | (static_cast<uint32_t>(in[2]) << 16) | (static_cast<uint32_t>(in[3]) << 24);
+    }
+
+    uint32_t state_[16];
+    chacha20_kernel kernel_;
+};
+
+/// <summary>
+/// encrypt or decrypt a source string with any cipher engine
+/// </summary>
+/// <param name="source">input string to process</param>
+/// <param name="engine">cipher to use</param>
+/// <param name="output">receives the transformed string</param>
+/// <returns>false when the source is longer than the cipher's stream</returns>
+bool encrypt_decrypt(const std::string& source, const cipher_engine& engine, std::string& output)
+{
+    output.assign(source.length(), '\0');
+    return engine.transform(source.data(), &output[0], source.length(), 0);
+}
+
+/// <summary>
+/// cipher_engine::transform split across the pool in parallel_chunk_size pieces, each at its own
+/// stream position, so the result is byte for byte the same as the serial call
+/// </summary>
+/// <returns>false when any piece lies beyond the end of the cipher's stream</returns>
+bool parallel_transform(const cipher_engine& engine, const char* src, char* dst, size_t length, uint64_t position, thread_pool& pool)
+{
+    const size_t chunk_count = (length + parallel_chunk_size - 1) / parallel_chunk_size;
+    if (chunk_count < 2 || pool.size() < 2)
+    { // not worth waking anyone up
+        return engine.transform(src, dst, length, position);
+    }
+
+    std::atomic<bool> succeeded(true);
+    pool.parallel_for(chunk_count, [&](size_t chunk) {
+        const size_t begin = chunk * parallel_chunk_size;
+        const size_t count = std::min(parallel_chunk_size, length - begin);
+        if (!engine.transform(src + begin, dst + begin, count, position + begin))
+        {
+            succeeded = false;
+        }
+    });
+    return succeeded;
+}
+
+/// <summary>
+/// read a chacha20 key string: 64 hex digits of key followed by 24 hex digits of nonce
+/// </summary>
+/// <returns>false when the string is not exactly that</returns>
+bool parse_chacha20_key(const std::string& text, unsigned char* key, unsigned char* nonce)
+{
+    if (text.length() != (chacha20_key_size + chacha20_nonce_size) * 2)
+    {
+        return false;
+    }
+    auto hex_digit = [](char c) -> int {
+        const char* const digits = "0123456789abcdef";
+        const char* found = std::strchr(digits, std::tolower(static_cast<unsigned char>(c)));
+        return c != '\0' && found != nullptr ? static_cast<int>(found - digits) : -1;
+    };
+    for (size_t i = 0; i < text.length(); i += 2)
+    {
+        const int high = hex_digit(text[i]);
+        const int low = hex_digit(text[i + 1]);
+        if (high < 0 || low < 0)
+        {
+            return false;
+        }
+        const size_t index = i / 2;
+        unsigned char* out = index < chacha20_key_size ? key + index : nonce + (index - chacha20_key_size);
+        *out = static_cast<unsigned char>(high * 16 + low);
+    }
+    return true;
+}
+
+/// <summary>
+/// build the engine named by default_cipher_settings for a key. xor takes any non empty key, chacha20 a key
+/// and nonce in hex (see parse_chacha20_key) and starts at block counter 1, as RFC 8439 encryption does.
+/// </summary>
+/// <returns>null when the name is unknown or the key does not suit the cipher</returns>
+std::unique_ptr<cipher_engine> make_cipher_engine(const std::string& key)
+{
+    const std::string& name = default_cipher_settings().name;
+    if (name == "xor" && !key.empty())
+    {
+        return std::make_unique<xor_cipher>(key);
+    }
+    unsigned char chacha20_key[chacha20_key_size];
+    unsigned char chacha20_nonce[chacha20_nonce_size];
+    if (name == "chacha20" && parse_chacha20_key(key, chacha20_key, chacha20_nonce))
+    {
+        return std::make_unique<chacha20_cipher>(chacha20_key, chacha20_nonce, 1);
+    }
+    return nullptr;
+}
+
+/// <summary>
+/// check every chacha20 kernel against the RFC 8439 test vectors (sections 2.3.2 and 2.4.2), and the
+/// vector kernels against the scalar one over enough blocks to fill their widest groups, and that the
+/// block counter is refused rather than wrapped at its end
+/// </summary>
+/// <returns>true when all checks pass</returns>
+bool chacha20_self_test()
+{
+    unsigned char key[chacha20_key_size];
+    for (size_t i = 0; i < sizeof(key); ++i)
+    {
+        key[i] = static_cast<unsigned char>(i);
+    }
+
+    // 2.3.2: one block of keystream, counter 1
+    const unsigned char block_nonce[chacha20_nonce_size] = { 0x00, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0x4a, 0x00, 0x00, 0x00, 0x00 };
+    const unsigned char block_expected[chacha20_block_size] = {
+        0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15, 0x50, 0x0f, 0xdd, 0x1f, 0xa3, 0x20, 0x71, 0xc4,
+        0xc7, 0xd1, 0xf4, 0xc7, 0x33, 0xc0, 0x68, 0x03, 0x04, 0x22, 0xaa, 0x9a, 0xc3, 0xd4, 0x6c, 0x4e,
+        0xd2, 0x82, 0x64, 0x46, 0x07, 0x9f, 0xaa, 0x09, 0x14, 0xc2, 0xd7, 0x05, 0xd9, 0x8b, 0x02, 0xa2,
+        0xb5, 0x12, 0x9c, 0xd1, 0xde, 0x16, 0x4e, 0xb9, 0xcb, 0xd0, 0x83, 0xe8, 0xa2, 0x50, 0x3c, 0x4e,
+    };
+
+    // 2.4.2: encryption of the sunscreen text, counter 1
+    const unsigned char text_nonce[chacha20_nonce_size] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x4a, 0x00, 0x00, 0x00, 0x00 };
+    const std::string plaintext = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+    const unsigned char text_expected[] = {
+        0x6e, 0x2e, 0x35, 0x9a, 0x25, 0x68, 0xf9, 0x80, 0x41, 0xba, 0x07, 0x28, 0xdd, 0x0d, 0x69, 0x81,
+        0xe9, 0x7e, 0x7a, 0xec, 0x1d, 0x43, 0x60, 0xc2, 0x0a, 0x27, 0xaf, 0xcc, 0xfd, 0x9f, 0xae, 0x0b,
+        0xf9, 0x1b, 0x65, 0xc5, 0x52, 0x47, 0x33, 0xab, 0x8f, 0x59, 0x3d, 0xab, 0xcd, 0x62, 0xb3, 0x57,
+        0x16, 0x39, 0xd6, 0x24, 0xe6, 0x51, 0x52, 0xab, 0x8f, 0x53, 0x0c, 0x35, 0x9f, 0x08, 0x61, 0xd8,
+        0x07, 0xca, 0x0d, 0xbf, 0x50, 0x0d, 0x6a, 0x61, 0x56, 0xa3, 0x8e, 0x08, 0x8a, 0x22, 0xb6, 0x5e,
+        0x52, 0xbc, 0x51, 0x4d, 0x16, 0xcc, 0xf8, 0x06, 0x81, 0x8c, 0xe9, 0x1a, 0xb7, 0x79, 0x37, 0x36,
+        0x5a, 0xf9, 0x0b, 0xbf, 0x74, 0xa3, 0x5b, 0xe6, 0xb4, 0x0b, 0x8e, 0xed, 0xf2, 0x78, 0x5e, 0x42,
+        0x87, 0x4d,
+    };
+    assert(plaintext.length() == sizeof(text_expected));
+
+    std::vector<chacha20_kernel> kernels = { chacha20_keystream_scalar };
+#if defined(ENCRYPTION_X86_64)
+    if (cpu_supports("sse2"))
+    {
+        kernels.push_back(chacha20_keystream_sse2);
+    }
+    if (cpu_supports("avx2"))
+    {
+        kernels.push_back(chacha20_keystream_avx2);
+    }
+#endif
+
+    // a long run of keystream from the scalar kernel to hold the vector kernels to
+    const std::string zeros(37 * chacha20_block_size + 5, '\0');
+    std::string reference;
+    bool passed = encrypt_decrypt(zeros, chacha20_cipher(key, text_nonce, 7, chacha20_keystream_scalar), reference);
+
+    for (chacha20_kernel kernel : kernels)
+    {
+        std::string block;
+        passed = passed && encrypt_decrypt(std::string(chacha20_block_size, '\0'), chacha20_cipher(key, block_nonce, 1, kernel), block);
+        passed = passed && std::memcmp(block.data(), block_expected, sizeof(block_expected)) == 0;
+
+        const chacha20_cipher text_cipher(key, text_nonce, 1, kernel);
+        std::string ciphertext;
+        std::string decrypted;
+        passed = passed && encrypt_decrypt(plaintext, text_cipher, ciphertext);
+        passed = passed && std::memcmp(ciphertext.data(), text_expected, sizeof(text_expected)) == 0;
+        passed = passed && encrypt_decrypt(ciphertext, text_cipher, decrypted) && decrypted == plaintext;
+
+        // positions inside a block and across batches must line up with the one pass result
+        const chacha20_cipher long_cipher(key, text_nonce, 7, kernel);
+        std::string whole;
+        passed = passed && encrypt_decrypt(zeros, long_cipher, whole) && whole == reference;
+        std::string slice(zeros.length() - 100, '\0');
+        passed = passed && long_cipher.transform(slice.data(), &slice[0], slice.length() - 3, 67);
+        passed = passed && slice.compare(0, slice.length() - 3, reference, 67, slice.length() - 3) == 0;
+
+        // the last block of the counter can be used, anything past it is refused rather than wrapped
+        const chacha20_cipher last_block_cipher(key, text_nonce, 0xFFFFFFFFu, kernel);
+        std::string last;
+        passed = passed && encrypt_decrypt(std::string(chacha20_block_size, '\0'), last_block_cipher, last);
+        passed = passed && !encrypt_decrypt(std::string(chacha20_block_size + 1, '\0'), last_block_cipher, last);
+        passed = passed && !last_block_cipher.transform(slice.data(), &slice[0], 1, chacha20_block_size);
+        passed = passed && !long_cipher.transform(slice.data(), &slice[0], 1, 0xFFFFFFFFull * chacha20_block_size);
+    }
+    return passed;
+}
+
+/// <summary>
+/// run the chacha20 self test and report the throughput of every cipher engine
+/// </summary>
+/// <returns>true when the self test passed</returns>
+bool run_cipher_report()
+{
+    const bool passed = chacha20_self_test();
+    std::cout << "ChaCha20 RFC 8439 test vectors: " << (passed ? "passed" : "FAILED") << std::endl;
+
+    const char* xor_kernel_name = nullptr;
+    const char* chacha20_kernel_name = nullptr;
+    select_xor_kernel(&xor_kernel_name);
+    select_chacha20_kernel(&chacha20_kernel_name);
+
+    const unsigned char key[chacha20_key_size] = {};
+    const unsigned char nonce[chacha20_nonce_size] = {};
+    const xor_cipher xor_engine("password");
+    const chacha20_cipher chacha20_engine(key, nonce, 0);
+    const size_t bytes = 16 * 1024 * 1024;
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << xor_engine.name() << " (" << xor_kernel_name << "): " << xor_engine.measure_throughput(bytes, 10) << " GB/s" << std::endl;
+    std::cout << chacha20_engine.name() << " (" << chacha20_kernel_name << "): " << chacha20_engine.measure_throughput(bytes, 10) << " GB/s" << std::endl;
+    return passed;
+}
+
+std::string read_file(const std::string& filename)
+{
+    std::string file_text = "John Q. Smith\nThis is my test string";
+
+    // TODO: implement loading the file into a string
+    std::ifstream in(filename);
+    if (in)
+    {
+        std::stringstream buffer;
+        buffer << in.rdbuf();
+        file_text = buffer.str();
+    }
+
+    return file_text;
+}
+
+std::string get_student_name(const std::string& string_data)
+{
+    std::string student_name;
+
+    // find the first newline
+    size_t pos = string_data.find('\n');
+    // did we find a newline
+    if (pos != std::string::npos)
+    { // we did, so copy that substring as the student name
+        student_name = string_data.substr(0, pos);
+    }
+
+    return student_name;
+}
+
+/// <summary>
+/// the local time now, for the header timestamp
+/// </summary>
+std::tm current_local_time()
+{
+    std::time_t t = std::time(nullptr);
+    std::tm tm;
+#if defined(_WIN32)
+    localtime_s(&tm, &t);
+#else
+    localtime_r(&t, &tm);
+#endif
+    return tm;
+}
+
+/// <summary>
+/// write the four line data file header shared by every output path
+/// </summary>
+/// <param name="out">stream positioned at the start of the file</param>
+/// <param name="student_name">line 1</param>
+/// <param name="key">line 3</param>
+void write_data_header(std::ostream& out, const std::string& student_name, const std::string& key)
+{
+    // Line 1: student name
+    out << student_name << '\n';
+
+    // Line 2: timestamp (yyyy-mm-dd)
+    const std::tm tm = current_local_time();
+    out << std::put_time(&tm, "%Y-%m-%d") << '\n';
+
+    // Line 3: key used
+    out << key << '\n';
+}
+
+void save_data_file(const std::string& filename, const std::string& student_name, const std::string& key, const std::string& data)
+{
+    //  TODO: implement file saving
+    //  file format
+    //  Line 1: student name
+    //  Line 2: timestamp (yyyy-mm-dd)
+    //  Line 3: key used
+    //  Line 4+: data
+
+    std::ofstream out(filename);
+
+    // Lines 1-3: header
+    write_data_header(out, student_name, key);
+
+    // Line 4+: data
+    out << data;
+}
+
+// every pooled block is aligned to a cache line, which is also the width of the widest vector loads
+const size_t buffer_alignment = 64;
+
+// blocks at least this large can be aligned to it and backed by huge pages, where the system allows
+const size_t huge_page_size = 2 * 1024 * 1024;
+
+// smallest block handed out, smaller requests share it
+const size_t buffer_pool_min_block = 4096;
+
+// blocks cached for reuse past this total are freed instead
+const size_t buffer_pool_max_cached_bytes = size_t(256) * 1024 * 1024;
+
+/// <summary>
+/// overwrite memory with zeros in a way the compiler may not drop, even when the memory is about to be freed
+/// </summary>
+void secure_zero(void* data, size_t length)
+{
+#if defined(_WIN32)
+    SecureZeroMemory(data, length);
+#else
+    std::memset(data, 0, length);
+    __asm__ __volatile__("" : : "r"(data) : "memory");
+#endif
+}
+
+class buffer_pool;
+buffer_pool& default_buffer_pool();
+
+/// <summary>
+/// a block borrowed from a buffer_pool. it is wiped and handed back when the buffer is destroyed or released.
+/// the interface is the part of std::vector&lt;char&gt; the i/o paths use, so it can stand in for one, except that
+/// bytes added by growing are not zeroed.
+/// </summary>
+class pooled_buffer
+{
+public:
+    /// <summary>
+    /// an empty buffer that borrows from the default pool on first resize
+    /// </summary>
+    pooled_buffer() = default;
+    explicit pooled_buffer(buffer_pool& pool) : pool_(&pool) {}
+    ~pooled_buffer() { release(); }
+
+    pooled_buffer(pooled_buffer&& other) noexcept { swap(other); }
+    pooled_buffer& operator=(pooled_buffer&& other) noexcept
+    {
+        pooled_buffer moved(std::move(other));
+        swap(moved);
+        return *this;
+    }
+    pooled_buffer(const pooled_buffer&) = delete;
+    pooled_buffer& operator=(const pooled_buffer&) = delete;
+
+    char* data() { return data_; }
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    size_t capacity() const { return capacity_; }
+    bool empty() const { return size_ == 0; }
+
+    /// <summary>
+    /// change the size, borrowing a larger block when needed. contents up to the old size are kept.
+    /// </summary>
+    void resize(size_t size);
+
+    /// <summary>
+    /// wipe the block and give it back to the pool, leaving the buffer empty
+    /// </summary>
+    void release();
+
+    void swap(pooled_buffer& other) noexcept
+    {
+        std::swap(pool_, other.pool_);
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(capacity_, other.capacity_);
+        std::swap(used_, other.used_);
+    }
+
+private:
+    buffer_pool* pool_ = nullptr;
+    char* data_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+    size_t used_ = 0; // high water mark of size_, everything below it may hold data and is wiped on release
+};
+
+/// <summary>
+/// cache of aligned blocks in power of two size classes. blocks are wiped when they come back, then kept for the
+/// next borrower, so steady state i/o neither calls malloc nor faults in fresh pages, and no key or plaintext
+/// is left in memory that has gone back to the heap. optionally blocks are locked in memory so they are
+/// never swapped out, and large blocks are placed on huge pages.
+/// </summary>
+class buffer_pool
+{
+public:
+    /// <param name="huge_pages">align blocks of huge_page_size and up to it and ask for huge pages</param>
+    /// <param name="lock_memory">mlock (VirtualLock) every block, failures are counted and the block used unlocked</param>
+    /// <param name="max_cached_bytes">most bytes kept for reuse</param>
+    buffer_pool(bool huge_pages, bool lock_memory, size_t max_cached_bytes = buffer_pool_max_cached_bytes)
+        : huge_pages_(huge_pages), lock_memory_(lock_memory), max_cached_bytes_(max_cached_bytes)
+    {
+    }
+
+    /// <summary>
+    /// frees the cached blocks. every buffer borrowed from the pool must have been released first.
+    /// </summary>
+    ~buffer_pool()
+    {
+        for (size_t size_class = 0; size_class < free_blocks_.size(); ++size_class)
+        {
+            for (char* data : free_blocks_[size_class])
+            {
+                free_block(data, size_t(1) << size_class);
+            }
+        }
+    }
+
+    buffer_pool(const buffer_pool&) = delete;
+    buffer_pool& operator=(const buffer_pool&) = delete;
+
+    /// <summary>
+    /// borrow a buffer of size bytes
+    /// </summary>
+    pooled_buffer acquire(size_t size)
+    {
+        pooled_buffer buffer(*this);
+        buffer.resize(size);
+        return buffer;
+    }
+
+    /// <summary>
+    /// blocks taken from the heap, blocks served from the cache, and blocks that could not be locked
+    /// </summary>
+    void statistics(size_t& allocated, size_t& reused, size_t& lock_failures) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        allocated = blocks_allocated_;
+        reused = blocks_reused_;
+        lock_failures = lock_failures_;
+    }
+
+private:
+    friend class pooled_buffer;
+
+    /// <summary>
+    /// a block of at least size bytes, capacity receives its real size
+    /// </summary>
+    char* borrow(size_t size, size_t& capacity)
+    {
+        size_t size_class = 0;
+        while ((size_t(1) << size_class) < std::max(size, buffer_pool_min_block))
+        {
+            ++size_class;
+        }
+        capacity = size_t(1) << size_class;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!free_blocks_[size_class].empty())
+            {
+                char* data = free_blocks_[size_class].back();
+                free_blocks_[size_class].pop_back();
+                cached_bytes_ -= capacity;
+                ++blocks_reused_;
+                return data;
+            }
+        }
+        return allocate_block(capacity);
+    }
+
+    /// <summary>
+    /// take a block back. the first used bytes are wiped, the rest was wiped when the block last came back.
+    /// </summary>
+    void give_back(char* data, size_t capacity, size_t used)
+    {
+        secure_zero(data, used);
+        size_t size_class = 0;
+        while ((size_t(1) << size_class) < capacity)
+        {
+            ++size_class;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (cached_bytes_ + capacity <= max_cached_bytes_)
+            {
+                free_blocks_[size_class].push_back(data);
+                cached_bytes_ += capacity;
+                return;
+            }
+        }
+        free_block(data, capacity);
+    }
+
+    char* allocate_block(size_t capacity)
+    {
+        const size_t alignment = huge_pages_ && capacity >= huge_page_size ? huge_page_size : buffer_alignment;
+#if defined(_WIN32)
+        char* data = static_cast<char*>(_aligned_malloc(capacity, alignment));
+#else
+        void* memory = nullptr;
+        char* data = posix_memalign(&memory, alignment, capacity) == 0 ? static_cast<char*>(memory) : nullptr;
+#endif
+        if (data == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+#if defined(MADV_HUGEPAGE)
+        if (alignment == huge_page_size)
+        {
+            madvise(data, capacity, MADV_HUGEPAGE);
+        }
+#endif
+        // new blocks start zeroed, so give_back only ever has to wipe what a borrower used
+        std::memset(data, 0, capacity);
+
+        bool locked = true;
+        if (lock_memory_)
+        {
+#if defined(_WIN32)
+            locked = VirtualLock(data, capacity) != FALSE;
+#else
+            locked = mlock(data, capacity) == 0;
+#endif
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++blocks_allocated_;
+        if (!locked)
+        {
+            ++lock_failures_;
+        }
+        return data;
+    }
+
+    void free_block(char* data, size_t capacity)
+    {
+        if (lock_memory_)
+        {
+#if defined(_WIN32)
+            VirtualUnlock(data, capacity);
+#else
+            munlock(data, capacity);
+#endif
+        }
+#if defined(_WIN32)
+        _aligned_free(data);
+#else
+        std::free(data);
+#endif
+    }
+
+    const bool huge_pages_;
+    const bool lock_memory_;
+    const size_t max_cached_bytes_;
+    mutable std::mutex mutex_;
+    std::vector<std::vector<char*>> free_blocks_ = std::vector<std::vector<char*>>(sizeof(size_t) * 8);
+    size_t cached_bytes_ = 0;
+    size_t blocks_allocated_ = 0;
+    size_t blocks_reused_ = 0;
+    size_t lock_failures_ = 0;
+};
+
+void pooled_buffer::resize(size_t size)
+{
+    if (size > capacity_)
+    {
+        if (pool_ == nullptr)
+        {
+            pool_ = &default_buffer_pool();
+        }
+        size_t capacity = 0;
+        char* data = pool_->borrow(size, capacity);
+        if (data_ != nullptr)
+        {
+            std::memcpy(data, data_, size_);
+            pool_->give_back(data_, capacity_, used_);
+        }
+        data_ = data;
+        capacity_ = capacity;
+    }
+    size_ = size;
+    used_ = std::max(used_, size_);
+}
+
+void pooled_buffer::release()
+{
+    if (data_ != nullptr)
+    {
+        pool_->give_back(data_, capacity_, used_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    capacity_ = 0;
+    used_ = 0;
+}
+
+/// <summary>
+/// how the default pool is set up, changed from the command line before the first buffer is borrowed
+/// </summary>
+struct buffer_pool_settings
+{
+    bool huge_pages = false;
+    bool lock_memory = false;
+};
+
+buffer_pool_settings& default_buffer_pool_settings()
+{
+    static buffer_pool_settings settings;
+    return settings;
+}
+
+/// <summary>
+/// the pool the i/o paths borrow from, created on first use
+/// </summary>
+buffer_pool& default_buffer_pool()
+{
+    static buffer_pool pool(default_buffer_pool_settings().huge_pages, default_buffer_pool_settings().lock_memory);
+    return pool;
+}
+
+// the functions below are the allocation free path: files are read straight into a caller owned buffer,
+// transformed in place or into a caller supplied buffer, and written back with one gathered write.
+// text is passed as string_view into those buffers instead of being copied into new strings.
+
+/// <summary>
+/// read a whole file, in binary, into buffer. the buffer is resized to the file size and only
+/// reallocates when its capacity is too small, so a reused or pooled buffer makes this allocation free.
+/// </summary>
+/// <param name="filename">file to read</param>
+/// <param name="buffer">std::vector&lt;char&gt; or pooled_buffer, receives the file bytes</param>
+/// <returns>true on success</returns>
+template <typename Buffer>
+bool read_file_into(const char* filename, Buffer& buffer)
+{
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    LARGE_INTEGER file_size;
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    if (!GetFileSizeEx(file, &file_size))
+    {
+        CloseHandle(file);
+        return false;
+    }
+    buffer.resize(static_cast<size_t>(file_size.QuadPart));
+    size_t total = 0;
+    bool succeeded = true;
+    while (total < buffer.size())
+    {
+        const DWORD request = static_cast<DWORD>(std::min<size_t>(buffer.size() - total, 1u << 30));
+        DWORD count = 0;
+        if (!ReadFile(file, buffer.data() + total, request, &count, nullptr))
+        {
+            succeeded = false;
+            break;
+        }
+        if (count == 0)
+        {
+            break;
+        }
+        total += count;
+    }
+    CloseHandle(file);
+#else
+    const int fd = ::open(filename, O_RDONLY);
+    struct stat info;
+    if (fd < 0)
+    {
+        return false;
+    }
+    if (fstat(fd, &info) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    buffer.resize(static_cast<size_t>(info.st_size));
+    size_t total = 0;
+    bool succeeded = true;
+    while (total < buffer.size())
+    {
+        const ssize_t count = ::read(fd, buffer.data() + total, buffer.size() - total);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count < 0)
+        {
+            succeeded = false;
+            break;
+        }
+        if (count == 0)
+        {
+            break;
+        }
+        total += static_cast<size_t>(count);
+    }
+    ::close(fd);
+#endif
+    if (!succeeded)
+    {
+        buffer.resize(0);
+        return false;
+    }
+    // a file that shrank while we read it just gives what was there
+    buffer.resize(total);
+    return true;
+}
+
+/// <summary>
+/// same as get_student_name, but returns a view into string_data instead of a copy
+/// </summary>
+std::string_view get_student_name_view(std::string_view string_data)
+{
+    const size_t pos = string_data.find('\n');
+    return pos == std::string_view::npos ? std::string_view() : string_data.substr(0, pos);
+}
+
+/// <summary>
+/// find the student name and the body of a saved data file without copying either
+/// </summary>
+/// <param name="file_data">whole saved data file</param>
+/// <param name="student_name">receives line 1</param>
+/// <param name="body">receives everything after line 3</param>
+/// <returns>false when the file does not have a full three line header</returns>
+bool split_data_file(std::string_view file_data, std::string_view& student_name, std::string_view& body)
+{
+    size_t body_offset = 0;
+    for (int line = 0; line < 3; ++line)
+    {
+        const size_t newline = file_data.find('\n', body_offset);
+        if (newline == std::string_view::npos)
+        {
+            return false;
+        }
+        body_offset = newline + 1;
+    }
+    student_name = get_student_name_view(file_data);
+    body = file_data.substr(body_offset);
+    return true;
+}
+
+/// <summary>
+/// encrypt or decrypt length bytes of data in place
+/// </summary>
+void encrypt_decrypt_in_place(char* data, size_t length, std::string_view key)
+{
+    assert(!key.empty());
+    xor_transform(data, data, length, key.data(), key.length(), 0);
+}
+
+/// <summary>
+/// encrypt or decrypt source into output, which must hold at least source.length() bytes
+/// </summary>
+void encrypt_decrypt_into(std::string_view source, std::string_view key, char* output)
+{
+    assert(!key.empty());
+    xor_transform(source.data(), output, source.length(), key.data(), key.length(), 0);
+}
+
+/// <summary>
+/// format the same header as write_data_header into a caller supplied buffer
+/// </summary>
+/// <param name="buffer">receives the header text, not null terminated</param>
+/// <param name="capacity">size of buffer</param>
+/// <param name="student_name">line 1</param>
+/// <param name="key">line 3</param>
+/// <returns>the header length. when that is more than capacity nothing is written and the caller should retry with a bigger buffer.</returns>
+size_t format_data_header(char* buffer, size_t capacity, std::string_view student_name, std::string_view key)
+{
+    const std::tm tm = current_local_time();
+    char date[16];
+    const size_t date_length = std::strftime(date, sizeof(date), "%Y-%m-%d", &tm);
+
+    const size_t length = student_name.length() + 1 + date_length + 1 + key.length() + 1;
+    if (length > capacity)
+    {
+        return length;
+    }
+
+    char* out = buffer;
+    std::memcpy(out, student_name.data(), student_name.length());
+    out += student_name.length();
+    *out++ = '\n';
+    std::memcpy(out, date, date_length);
+    out += date_length;
+    *out++ = '\n';
+    std::memcpy(out, key.data(), key.length());
+    out += key.length();
+    *out++ = '\n';
+    return length;
+}
+
+/// <summary>
+/// create filename holding header followed by body, written with a single gathered write where the
+/// platform has one. the file is written in binary mode.
+/// </summary>
+/// <returns>true on success</returns>
+bool write_data_file(const char* filename, std::string_view header, std::string_view body)
+{
+#if defined(_WIN32)
+    // WriteFileGather needs unbuffered, sector aligned i/o, so two plain writes is the closest fit here
+    HANDLE file = CreateFileA(filename, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    bool succeeded = true;
+    for (std::string_view part : { header, body })
+    {
+        while (succeeded && !part.empty())
+        {
+            DWORD count = 0;
+            const DWORD request = static_cast<DWORD>(std::min<size_t>(part.length(), 1u << 30));
+            succeeded = WriteFile(file, part.data(), request, &count, nullptr) != FALSE;
+            part.remove_prefix(count);
+        }
+    }
+    CloseHandle(file);
+    return succeeded;
+#else
+    const int fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+    iovec parts[2] = {
+        { const_cast<char*>(header.data()), header.length() },
+        { const_cast<char*>(body.data()), body.length() },
+    };
+    iovec* next = parts;
+    int remaining = 2;
+    bool succeeded = true;
+    while (remaining > 0)
+    {
+        ssize_t count = ::writev(fd, next, remaining);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count < 0)
+        {
+            succeeded = false;
+            break;
+        }
+        // a short write leaves us part way through one of the pieces
+        while (remaining > 0 && static_cast<size_t>(count) >= next->iov_len)
+        {
+            count -= static_cast<ssize_t>(next->iov_len);
+            ++next;
+            --remaining;
+        }
+        if (remaining > 0)
+        {
+            next->iov_base = static_cast<char*>(next->iov_base) + count;
+            next->iov_len -= static_cast<size_t>(count);
+        }
+    }
+    succeeded = ::close(fd) == 0 && succeeded;
+    return succeeded;
+#endif
+}
+
+// size of the one buffer used by the streaming path, so memory use does not grow with the file
+const size_t stream_chunk_size = 1 << 20;
+
+/// <summary>
+/// read one line, without its newline, giving up after stream_chunk_size bytes so a file with no
+/// newline near the top, such as a binary file, is never pulled into memory looking for one
+/// </summary>
+/// <returns>true when a newline was found within the limit</returns>
+bool read_bounded_line(std::istream& in, std::string& line)
+{
+    line.clear();
+    while (line.length() < stream_chunk_size)
+    {
+        const std::istream::int_type c = in.get();
+        if (c == std::istream::traits_type::eof())
+        {
+            return false;
+        }
+        if (c == '\n')
+        {
+            return true;
+        }
+        line.push_back(static_cast<char>(c));
+    }
+    return false;
+}
+
+/// <summary>
+/// true when both names refer to one existing file, so creating the output would wipe the input before it is read
+/// </summary>
+bool same_file(const std::string& input_filename, const std::string& output_filename)
+{
+    std::error_code error;
+    return std::filesystem::equivalent(input_filename, output_filename, error);
+}
+
+/// <summary>
+/// open a streaming input and output, copy or build the student name, and write the output header.
+/// on success in is positioned at the first data byte.
+/// </summary>
+/// <param name="input_has_header">true when the input is a saved data file, whose three header lines are
+/// skipped and whose name is carried to the output. false for a plain input file, whose first line is the name.</param>
+/// <returns>true on success, otherwise the problem has been reported</returns>
+bool open_stream_files(std::ifstream& in, std::ofstream& out, const std::string& input_filename, const std::string& output_filename, const std::string& key, bool input_has_header)
+{
+    in.open(input_filename);
+    if (!in)
+    {
+        std::cout << "Failed to open " << input_filename << std::endl;
+        return false;
+    }
+    if (same_file(input_filename, output_filename))
+    {
+        std::cout << "Input and output are the same file: " << input_filename << std::endl;
+        return false;
+    }
+
+    // get the student name without loading the file, same rules as get_student_name
+    std::string student_name;
+    if (input_has_header)
+    {
+        std::string date_line;
+        std::string key_line;
+        if (!read_bounded_line(in, student_name) || !read_bounded_line(in, date_line) || !read_bounded_line(in, key_line))
+        {
+            std::cout << "Missing data file header in " << input_filename << std::endl;
+            return false;
+        }
+    }
+    else
+    {
+        if (!read_bounded_line(in, student_name))
+        { // no newline within the limit, so no name
+            student_name.clear();
+        }
+        // the name line is part of the data, so start again from the top
+        in.clear();
+        in.seekg(0);
+    }
+
+    out.open(output_filename);
+    if (!out)
+    {
+        std::cout << "Failed to create " << output_filename << std::endl;
+        return false;
+    }
+    write_data_header(out, student_name, key);
+    return true;
+}
+
+/// <summary>
+/// encrypt or decrypt a file of any size through a fixed size buffer.
+/// produces the same file that read_file + encrypt_decrypt + save_data_file would.
+/// </summary>
+/// <param name="input_filename">file to read</param>
+/// <param name="output_filename">file to write</param>
+/// <param name="key">key to use in encryption / decryption</param>
+/// <param name="input_has_header">true when the input is a saved data file, false for a plain input file</param>
+/// <returns>true on success</returns>
+bool stream_encrypt_decrypt_file(const std::string& input_filename, const std::string& output_filename, const std::string& key, bool input_has_header)
+{
+    assert(!key.empty());
+
+    const std::unique_ptr<cipher_engine> engine = make_cipher_engine(key);
+    if (engine == nullptr)
+    {
+        std::cout << "The key does not suit the " << default_cipher_settings().name << " cipher" << std::endl;
+        return false;
+    }
+
+    std::ifstream in;
+    std::ofstream out;
+    if (!open_stream_files(in, out, input_filename, output_filename, key, input_has_header))
+    {
+        return false;
+    }
+
+    // the stream position carries across chunk boundaries, so the chunking is invisible in the output
+    pooled_buffer buffer = default_buffer_pool().acquire(stream_chunk_size);
+    uint64_t position = 0;
+    bool transformed = true;
+    while (in && transformed)
+    {
+        in.read(buffer.data(), buffer.size());
+        const size_t count = static_cast<size_t>(in.gcount());
+        if (count == 0)
+        {
+            break;
+        }
+        transformed = engine->transform(buffer.data(), buffer.data(), count, position);
+        position += count;
+        if (transformed)
+        {
+            out.write(buffer.data(), count);
+        }
+    }
+
+    if (!transformed)
+    {
+        std::cout << input_filename << " runs past the end of the " << engine->name() << " stream" << std::endl;
+        return false;
+    }
+    if (in.bad() || !out)
+    {
+        std::cout << "I/O error while streaming " << input_filename << " to " << output_filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/// <summary>
+/// a queue that blocks the consumer until an item arrives or the producer closes it
+/// </summary>
+template <typename T>
+class blocking_queue
+{
+public:
+    void push(T item)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            items_.push_back(std::move(item));
+        }
+        ready_.notify_one();
+    }
+
+    /// <summary>
+    /// no more items will be pushed. pop drains what is left, then returns false.
+    /// </summary>
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        ready_.notify_all();
+    }
+
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock, [this]() { return closed_ || !items_.empty(); });
+        if (items_.empty())
+        {
+            return false;
+        }
+        item = std::move(items_.front());
+        items_.pop_front();
+        return true;
+    }
+
+    /// <summary>
+    /// take an item if one is already waiting, without blocking
+    /// </summary>
+    bool try_pop(T& item)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (items_.empty())
+        {
+            return false;
+        }
+        item = std::move(items_.front());
+        items_.pop_front();
+        return true;
+    }
+
+private:
+    std::deque<T> items_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    bool closed_ = false;
+};
+
+// buffers in flight in the pipelined path: one being read, one being transformed, one being written,
+// and a spare so a slow stage does not stall the others on every chunk
+const size_t pipeline_buffer_count = 4;
+
+/// <summary>
+/// the streaming transform split into three overlapping stages. a reader thread fills buffers, the
+/// calling thread transforms them, and a writer thread drains them, so chunk N+1 is read while chunk N
+/// is transformed and chunk N-1 is written. buffers circulate through queues, so memory stays at
+/// pipeline_buffer_count chunks for any file size. produces the same file as stream_encrypt_decrypt_file.
+/// </summary>
+/// <param name="input_filename">file to read</param>
+/// <param name="output_filename">file to write</param>
+/// <param name="key">key to use in encryption / decryption</param>
+/// <param name="input_has_header">true when the input is a saved data file, false for a plain input file</param>
+/// <returns>true on success</returns>
+bool pipelined_encrypt_decrypt_file(const std::string& input_filename, const std::string& output_filename, const std::string& key, bool input_has_header)
+{
+    assert(!key.empty());
+
+    const std::unique_ptr<cipher_engine> engine = make_cipher_engine(key);
+    if (engine == nullptr)
+    {
+        std::cout << "The key does not suit the " << default_cipher_settings().name << " cipher" << std::endl;
+        return false;
+    }
+
+    std::ifstream in;
+    std::ofstream out;
+    if (!open_stream_files(in, out, input_filename, output_filename, key, input_has_header))
+    {
+        return false;
+    }
+
+    struct chunk
+    {
+        pooled_buffer data;
+        size_t count = 0;
+    };
+    std::vector<chunk> chunks(pipeline_buffer_count);
+
+    // each queue carries indexes into chunks: free -> read -> transformed -> free
+    blocking_queue<size_t> free_chunks;
+    blocking_queue<size_t> read_chunks;
+    blocking_queue<size_t> transformed_chunks;
+    for (size_t i = 0; i < chunks.size(); ++i)
+    {
+        chunks[i].data.resize(stream_chunk_size);
+        free_chunks.push(i);
+    }
+
+    bool read_failed = false;
+    std::thread reader([&]() {
+        size_t index = 0;
+        while (free_chunks.pop(index))
+        {
+            chunk& current = chunks[index];
+            in.read(current.data.data(), current.data.size());
+            current.count = static_cast<size_t>(in.gcount());
+            if (current.count == 0)
+            {
+                break;
+            }
+            read_chunks.push(index);
+        }
+        read_failed = in.bad();
+        read_chunks.close();
+    });
+
+    bool write_failed = false;
+    std::thread writer([&]() {
+        size_t index = 0;
+        while (transformed_chunks.pop(index))
+        {
+            // after a failure keep recycling buffers so the other stages can finish
+            if (!write_failed)
+            {
+                out.write(chunks[index].data.data(), chunks[index].count);
+                write_failed = !out;
+            }
+            free_chunks.push(index);
+        }
+        // the reader may still be waiting for a buffer after it hit the end of the file
+        free_chunks.close();
+    });
+
+    // the stream position carries across chunk boundaries exactly as in the serial streaming path.
+    // once the cipher refuses a chunk the rest are still passed along empty, so every stage drains
+    size_t index = 0;
+    uint64_t position = 0;
+    bool transformed = true;
+    while (read_chunks.pop(index))
+    {
+        chunk& current = chunks[index];
+        transformed = transformed && engine->transform(current.data.data(), current.data.data(), current.count, position);
+        position += current.count;
+        if (!transformed)
+        { // never write out bytes the cipher did not transform
+            current.count = 0;
+        }
+        transformed_chunks.push(index);
+    }
+    transformed_chunks.close();
+
+    reader.join();
+    writer.join();
+
+    if (!transformed)
+    {
+        std::cout << input_filename << " runs past the end of the " << engine->name() << " stream" << std::endl;
+        return false;
+    }
+    if (read_failed || write_failed)
+    {
+        std::cout << "I/O error while streaming " << input_filename << " to " << output_filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/// <summary>
+/// a whole file mapped into memory, either read only or read write. unmapped and closed on destruction.
+/// </summary>
+class mapped_file
+{
+public:
+    mapped_file() = default;
+    ~mapped_file() { close(); }
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    /// <summary>
+    /// map an existing file read only, hinting that it will be read front to back
+    /// </summary>
+    bool open_read(const std::string& filename)
+    {
+        close();
+#if defined(_WIN32)
+        file_ = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        LARGE_INTEGER file_size;
+        if (file_ == INVALID_HANDLE_VALUE || !GetFileSizeEx(file_, &file_size))
+        {
+            return false;
+        }
+        return map(static_cast<size_t>(file_size.QuadPart), false);
+#else
+        fd_ = ::open(filename.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd_ < 0 || fstat(fd_, &info) != 0)
+        {
+            return false;
+        }
+        return map(static_cast<size_t>(info.st_size), false);
+#endif
+    }
+
+    /// <summary>
+    /// create (or truncate) a file of exactly size bytes and map it read write.
+    /// the blocks are allocated up front, so a full disk fails here instead of raising SIGBUS on a later
+    /// write through the mapping. call finish once the data is written to find out whether it reached the file.
+    /// </summary>
+    bool create(const std::string& filename, size_t size)
+    {
+        close();
+#if defined(_WIN32)
+        file_ = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+#else
+        fd_ = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0 || (size > 0 && posix_fallocate(fd_, 0, static_cast<off_t>(size)) != 0))
+        {
+            return false;
+        }
+#endif
+        return map(size, true);
+    }
+
+    /// <summary>
+    /// flush a mapping made by create to the file and close it, reporting any error on the way
+    /// </summary>
+    bool finish()
+    {
+        bool ok = true;
+#if defined(_WIN32)
+        if (data_ != nullptr)
+        {
+            ok = FlushViewOfFile(data_, 0) != 0;
+            ok = UnmapViewOfFile(data_) != 0 && ok;
+        }
+        if (mapping_ != nullptr)
+        {
+            CloseHandle(mapping_);
+        }
+        if (file_ != INVALID_HANDLE_VALUE)
+        {
+            ok = FlushFileBuffers(file_) != 0 && ok;
+            ok = CloseHandle(file_) != 0 && ok;
+        }
+        mapping_ = nullptr;
+        file_ = INVALID_HANDLE_VALUE;
+#else
+        if (data_ != nullptr)
+        {
+            ok = msync(data_, size_, MS_SYNC) == 0;
+            ok = munmap(data_, size_) == 0 && ok;
+        }
+        if (fd_ >= 0)
+        {
+            ok = ::close(fd_) == 0 && ok;
+        }
+        fd_ = -1;
+#endif
+        data_ = nullptr;
+        size_ = 0;
+        return ok;
+    }
+
+    void close()
+    {
+#if defined(_WIN32)
+        if (data_ != nullptr)
+        {
+            UnmapViewOfFile(data_);
+        }
+        if (mapping_ != nullptr)
+        {
+            CloseHandle(mapping_);
+        }
+        if (file_ != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(file_);
+        }
+        mapping_ = nullptr;
+        file_ = INVALID_HANDLE_VALUE;
+#else
+        if (data_ != nullptr)
+        {
+            munmap(data_, size_);
+        }
+        if (fd_ >= 0)
+        {
+            ::close(fd_);
+        }
+        fd_ = -1;
+#endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    bool map(size_t size, bool writable)
+    {
+        size_ = size;
+        if (size == 0)
+        { // nothing to map, an empty view is still a valid file
+            return true;
+        }
+#if defined(_WIN32)
+        // the mapping object extends the file to size when it is created writable
+        const ULARGE_INTEGER max_size = { { static_cast<DWORD>(static_cast<unsigned long long>(size) & 0xFFFFFFFFu),
+            static_cast<DWORD>(static_cast<unsigned long long>(size) >> 32) } };
+        mapping_ = CreateFileMappingA(file_, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, max_size.HighPart, max_size.LowPart, nullptr);
+        if (mapping_ == nullptr)
+        {
+            size_ = 0;
+            return false;
+        }
+        data_ = static_cast<char*>(MapViewOfFile(mapping_, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size));
+#else
+        void* view = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd_, 0);
+        data_ = view == MAP_FAILED ? nullptr : static_cast<char*>(view);
+        if (data_ != nullptr)
+        { // the transform touches every page once, in order
+            madvise(data_, size, MADV_SEQUENTIAL);
+        }
+#endif
+        if (data_ == nullptr)
+        {
+            size_ = 0;
+            return false;
+        }
+        return true;
+    }
+
+    char* data_ = nullptr;
+    size_t size_ = 0;
+#if defined(_WIN32)
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+};
+
+/// <summary>
+/// encrypt or decrypt a file by mapping the input and output and transforming straight from one mapping
+/// into the other on all cores, so the data never passes through iostream buffers.
+/// produces the same file as stream_encrypt_decrypt_file, except that the output is always written in
+/// binary mode (no newline translation on Windows).
+/// </summary>
+/// <param name="input_filename">file to read</param>
+/// <param name="output_filename">file to write</param>
+/// <param name="key">key to use in encryption / decryption</param>
+/// <param name="input_has_header">true when the input is a saved data file whose header must be skipped</param>
+/// <returns>true on success</returns>
+bool mmap_encrypt_decrypt_file(const std::string& input_filename, const std::string& output_filename, const std::string& key, bool input_has_header)
+{
+    assert(!key.empty());
+
+    const std::unique_ptr<cipher_engine> engine = make_cipher_engine(key);
+    if (engine == nullptr)
+    {
+        std::cout << "The key does not suit the " << default_cipher_settings().name << " cipher" << std::endl;
+        return false;
+    }
+
+    mapped_file in;
+    if (!in.open_read(input_filename))
+    {
+        std::cout << "Failed to map " << input_filename << std::endl;
+        return false;
+    }
+    if (same_file(input_filename, output_filename))
+    {
+        std::cout << "Input and output are the same file: " << input_filename << std::endl;
+        return false;
+    }
+
+    // find the student name and the start of the body in the mapped bytes
+    const std::string_view file_data(in.data(), in.size());
+    std::string_view student_name = get_student_name_view(file_data);
+    std::string_view body = file_data;
+    if (input_has_header && !split_data_file(file_data, student_name, body))
+    {
+        std::cout << "Missing data file header in " << input_filename << std::endl;
+        return false;
+    }
+
+    std::vector<char> header(format_data_header(nullptr, 0, student_name, key));
+    format_data_header(header.data(), header.size(), student_name, key);
+
+    // the header goes ahead of the body in the same mapping
+    mapped_file out;
+    if (!out.create(output_filename, header.size() + body.length()))
+    {
+        std::cout << "Failed to map " << output_filename << std::endl;
+        return false;
+    }
+    std::memcpy(out.data(), header.data(), header.size());
+    if (!parallel_transform(*engine, body.data(), out.data() + header.size(), body.length(), 0, default_thread_pool()))
+    {
+        std::cout << input_filename << " runs past the end of the " << engine->name() << " stream" << std::endl;
+        return false;
+    }
+    if (!out.finish())
+    {
+        std::cout << "Failed to write " << output_filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// in tree LZ77 codec for the optional compression stage, in the style of the LZ4 block format.
+// a block is a series of sequences: a token byte (high nibble literal count, low nibble match length - 4,
+// 15 meaning more length bytes follow, each added until one is below 255), the literals, then a 2 byte
+// little endian match offset and the extra match length bytes. the last sequence is literals only.
+// blocks are independent, so any number of them can be compressed or decompressed at once.
+const size_t lz_min_match = 4;
+const size_t lz_max_offset = 65535;
+const int lz_hash_bits = 12;
+// matches stop this far from the end so the block always finishes with literals
+const size_t lz_end_literals = 5;
+
+inline uint32_t lz_load32(const char* in)
+{
+    uint32_t value;
+    std::memcpy(&value, in, sizeof(value));
+    return value;
+}
+
+/// <summary>
+/// append a length that did not fit in its token nibble
+/// </summary>
+inline bool lz_put_length(char*& out, const char* out_end, size_t length)
+{
+    for (; length >= 255; length -= 255)
+    {
+        if (out == out_end)
+        {
+            return false;
+        }
+        *out++ = static_cast<char>(255);
+    }
+    if (out == out_end)
+    {
+        return false;
+    }
+    *out++ = static_cast<char>(length);
+    return true;
+}
+
+/// <summary>
+/// compress a block
+/// </summary>
+/// <param name="src">bytes to compress</param>
+/// <param name="length">number of bytes</param>
+/// <param name="dst">receives the compressed block</param>
+/// <param name="capacity">size of dst</param>
+/// <returns>the compressed size, or zero when it would not fit in capacity (store the block raw instead)</returns>
+size_t lz_compress(const char* src, size_t length, char* dst, size_t capacity)
+{
+    uint32_t table[1 << lz_hash_bits];
+    std::fill(std::begin(table), std::end(table), UINT32_MAX);
+
+    char* out = dst;
+    const char* const out_end = dst + capacity;
+    size_t anchor = 0;
+    size_t ip = 0;
+    const size_t match_limit = length > lz_end_literals + lz_min_match ? length - lz_end_literals - lz_min_match : 0;
+
+    auto emit = [&](size_t literal_count, size_t offset, size_t match_length, bool last) {
+        if (out == out_end)
+        {
+            return false;
+        }
+        char* token = out++;
+        const size_t match_code = last ? 0 : match_length - lz_min_match;
+        *token = static_cast<char>((std::min<size_t>(literal_count, 15) << 4) | std::min<size_t>(match_code, 15));
+        if (literal_count >= 15 && !lz_put_length(out, out_end, literal_count - 15))
+        {
+            return false;
+        }
+        if (static_cast<size_t>(out_end - out) < literal_count)
+        {
+            return false;
+        }
+        std::copy(src + anchor, src + anchor + literal_count, out);
+        out += literal_count;
+        if (last)
+        {
+            return true;
+        }
+        if (out_end - out < 2)
+        {
+            return false;
+        }
+        *out++ = static_cast<char>(offset & 0xFF);
+        *out++ = static_cast<char>(offset >> 8);
+        return match_code < 15 || lz_put_length(out, out_end, match_code - 15);
+    };
+
+    while (ip < match_limit)
+    {
+        const uint32_t sequence = lz_load32(src + ip);
+        const uint32_t hash = (sequence * 2654435761u) >> (32 - lz_hash_bits);
+        const uint32_t candidate = table[hash];
+        table[hash] = static_cast<uint32_t>(ip);
+
+        if (candidate != UINT32_MAX && ip - candidate <= lz_max_offset && lz_load32(src + candidate) == sequence)
+        {
+            size_t match_length = lz_min_match;
+            while (ip + match_length < length - lz_end_literals && src[candidate + match_length] == src[ip + match_length])
+            {
+                ++match_length;
+            }
+            if (!emit(ip - anchor, ip - candidate, match_length, false))
+            {
+                return 0;
+            }
+            ip += match_length;
+            anchor = ip;
+        }
+        else
+        {
+            ++ip;
+        }
+    }
+
+    if (!emit(length - anchor, 0, 0, true))
+    {
+        return 0;
+    }
+    return static_cast<size_t>(out - dst);
+}
+
+/// <summary>
+/// the most bytes a compressed block of compressed_size bytes can decode to: every extra length byte
+/// adds at most 255 bytes of match, and nothing else in the format expands faster
+/// </summary>
+inline uint64_t lz_max_raw_size(uint64_t compressed_size)
+{
+    return compressed_size * 255;
+}
+
+/// <summary>
+/// decompress a block made by lz_compress. every length and offset is checked, so a damaged block is
+/// reported rather than read or written out of bounds.
+/// </summary>
+/// <param name="src">compressed block</param>
+/// <param name="length">compressed size</param>
+/// <param name="dst">receives the original bytes</param>
+/// <param name="raw_length">original size, dst must hold this many bytes</param>
+/// <returns>true when the block decoded to exactly raw_length bytes</returns>
+bool lz_decompress(const char* src, size_t length, char* dst, size_t raw_length)
+{
+    size_t ip = 0;
+    size_t op = 0;
+
+    auto get_length = [&](size_t& value) {
+        unsigned char extra = 255;
+        while (extra == 255)
+        {
+            if (ip == length)
+            {
+                return false;
+            }
+            extra = static_cast<unsigned char>(src[ip++]);
+            value += extra;
+        }
+        return true;
+    };
+
+    while (ip < length)
+    {
+        const unsigned char token = static_cast<unsigned char>(src[ip++]);
+
+        size_t literal_count = token >> 4;
+        if (literal_count == 15 && !get_length(literal_count))
+        {
+            return false;
+        }
+        if (literal_count > length - ip || literal_count > raw_length - op)
+        {
+            return false;
+        }
+        std::copy(src + ip, src + ip + literal_count, dst + op);
+        ip += literal_count;
+        op += literal_count;
+
+        if (ip == length)
+        { // the last sequence has no match
+            break;
+        }
+
+        if (length - ip < 2)
+        {
+            return false;
+        }
+        const size_t offset = static_cast<unsigned char>(src[ip]) | (static_cast<size_t>(static_cast<unsigned char>(src[ip + 1])) << 8);
+        ip += 2;
+        size_t match_length = token & 0x0F;
+        if (match_length == 15 && !get_length(match_length))
+        {
+            return false;
+        }
+        match_length += lz_min_match;
+        if (offset == 0 || offset > op || match_length > raw_length - op)
+        {
+            return false;
+        }
+
+        // a match may overlap the bytes it is producing (offset < length), which repeats them
+        const char* match = dst + op - offset;
+        if (offset >= match_length)
+        {
+            std::memcpy(dst + op, match, match_length);
+        }
+        else
+        {
+            for (size_t i = 0; i < match_length; ++i)
+            {
+                dst[op + i] = match[i];
+            }
+        }
+        op += match_length;
+    }
+    return op == raw_length;
+}
+
+// binary container layout, all integers little endian:
+//   fixed header (container_header_size bytes)
+//     magic[8] "CS405ENC", u32 version, u32 header size, u32 metadata size, u32 chunk entry size,
+//     u32 chunk count, u32 chunk size, u64 payload size, and from version 3 u32 codec, u32 reserved
+//   metadata: student name, date, key, each as u32 length + bytes
+//   chunk table: chunk count entries of u64 file offset, u64 stored size,
+//     from version 2 u32 crc32c of the bytes before encryption, u32 crc32c of the stored bytes,
+//     and from version 3 u32 raw (uncompressed) size, u32 flags
+//   chunk data: each chunk compressed on its own when the codec is lz and that made it smaller
+//     (flag container_chunk_compressed), then encrypted with the key phase of its raw payload position
+// readers use the sizes recorded in the header rather than these constants, so later versions can
+// grow the header, metadata or table entries without breaking them.
+const char container_magic[8] = { 'C', 'S', '4', '0', '5', 'E', 'N', 'C' };
+const uint32_t container_version = 3;
+const uint32_t container_header_size = 48;
+const uint32_t container_v1_header_size = 40;
+const uint32_t container_chunk_entry_size = 32;
+const uint32_t container_v2_chunk_entry_size = 24;
+const uint32_t container_v1_chunk_entry_size = 16;
+
+// codecs a container can record
+const uint32_t container_codec_none = 0;
+const uint32_t container_codec_lz = 1;
+
+// chunk flags
+const uint32_t container_chunk_compressed = 1;
+
+/// <summary>
+/// where one chunk of a container lives
+/// </summary>
+struct container_chunk
+{
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    uint32_t plain_checksum = 0;
+    uint32_t stored_checksum = 0;
+    uint32_t raw_size = 0;
+    uint32_t flags = 0;
+};
+
+/// <summary>
+/// everything in a container except the chunk data
+/// </summary>
+struct container_info
+{
+    uint32_t version = 0;
+    uint32_t chunk_size = 0;
+    uint64_t payload_size = 0;
+    bool has_checksums = false;
+    uint32_t codec = container_codec_none;
+    std::string student_name;
+    std::string date;
+    std::string key;
+    std::vector<container_chunk> chunks;
+};
+
+void put_u32(std::string& out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+void put_u64(std::string& out, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+uint32_t get_u32(const char* in)
+{
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; --i)
+    {
+        value = (value << 8) | static_cast<unsigned char>(in[i]);
+    }
+    return value;
+}
+
+uint64_t get_u64(const char* in)
+{
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i)
+    {
+        value = (value << 8) | static_cast<unsigned char>(in[i]);
+    }
+    return value;
+}
+
+/// <summary>
+/// true when the stream starts with the container magic. leaves the stream at the start.
+/// </summary>
+bool is_container(std::istream& in)
+{
+    char magic[sizeof(container_magic)] = {};
+    in.seekg(0);
+    in.read(magic, sizeof(magic));
+    const bool matched = in.gcount() == sizeof(magic) && std::memcmp(magic, container_magic, sizeof(magic)) == 0;
+    in.clear();
+    in.seekg(0);
+    return matched;
+}
+
+/// <summary>
+/// build the header, metadata and chunk table for a container
+/// </summary>
+std::string format_container_prefix(const container_info& info)
+{
+    std::string metadata;
+    for (const std::string* field : { &info.student_name, &info.date, &info.key })
+    {
+        put_u32(metadata, static_cast<uint32_t>(field->length()));
+        metadata += *field;
+    }
+
+    std::string prefix(container_magic, sizeof(container_magic));
+    put_u32(prefix, info.version);
+    put_u32(prefix, container_header_size);
+    put_u32(prefix, static_cast<uint32_t>(metadata.length()));
+    put_u32(prefix, container_chunk_entry_size);
+    put_u32(prefix, static_cast<uint32_t>(info.chunks.size()));
+    put_u32(prefix, info.chunk_size);
+    put_u64(prefix, info.payload_size);
+    put_u32(prefix, info.codec);
+    put_u32(prefix, 0);
+    assert(prefix.length() == container_header_size);
+
+    prefix += metadata;
+    for (const auto& chunk : info.chunks)
+    {
+        put_u64(prefix, chunk.offset);
+        put_u64(prefix, chunk.size);
+        put_u32(prefix, chunk.plain_checksum);
+        put_u32(prefix, chunk.stored_checksum);
+        put_u32(prefix, chunk.raw_size);
+        put_u32(prefix, chunk.flags);
+    }
+    return prefix;
+}
+
+/// <summary>
+/// read and validate everything but the chunk data. the stream must be open in binary mode.
+/// every size in the header and chunk table is checked against the real length of the file before
+/// anything is allocated from it, so a damaged or crafted header cannot ask for gigabytes.
+/// </summary>
+/// <returns>false when the stream is not a readable container</returns>
+bool read_container_info(std::istream& in, container_info& info)
+{
+    in.seekg(0, std::ios::end);
+    const std::streamoff file_end = in.tellg();
+    if (file_end < 0)
+    {
+        return false;
+    }
+    const uint64_t file_length = static_cast<uint64_t>(file_end);
+
+    char header[container_header_size] = {};
+    in.seekg(0);
+    if (!in.read(header, container_v1_header_size) || std::memcmp(header, container_magic, sizeof(container_magic)) != 0)
+    {
+        return false;
+    }
+
+    info.version = get_u32(header + 8);
+    const uint32_t header_size = get_u32(header + 12);
+    const uint32_t metadata_size = get_u32(header + 16);
+    const uint32_t chunk_entry_size = get_u32(header + 20);
+    const uint32_t chunk_count = get_u32(header + 24);
+    info.chunk_size = get_u32(header + 28);
+    info.payload_size = get_u64(header + 32);
+    const uint32_t min_header_size = info.version >= 3 ? container_header_size : container_v1_header_size;
+    const uint32_t min_entry_size = info.version >= 3 ? container_chunk_entry_size
+        : info.version == 2 ? container_v2_chunk_entry_size : container_v1_chunk_entry_size;
+    if (info.version == 0 || info.version > container_version || header_size < min_header_size
+        || chunk_entry_size < min_entry_size || info.chunk_size == 0
+        || chunk_count != info.payload_size / info.chunk_size + (info.payload_size % info.chunk_size != 0))
+    {
+        return false;
+    }
+    // the metadata and the chunk table follow the header, all of them inside the file
+    if (header_size > file_length || metadata_size > file_length - header_size
+        || static_cast<uint64_t>(chunk_count) * chunk_entry_size > file_length - header_size - metadata_size)
+    {
+        return false;
+    }
+    if (info.version >= 3)
+    {
+        if (!in.read(header + container_v1_header_size, container_header_size - container_v1_header_size))
+        {
+            return false;
+        }
+        info.codec = get_u32(header + 40);
+        if (info.codec != container_codec_none && info.codec != container_codec_lz)
+        {
+            return false;
+        }
+    }
+
+    std::string metadata(metadata_size, '\0');
+    in.seekg(header_size);
+    if (!in.read(&metadata[0], metadata.length()))
+    {
+        return false;
+    }
+    size_t position = 0;
+    for (std::string* field : { &info.student_name, &info.date, &info.key })
+    {
+        if (position + 4 > metadata.length())
+        {
+            return false;
+        }
+        const uint32_t length = get_u32(metadata.data() + position);
+        position += 4;
+        if (length > metadata.length() - position)
+        {
+            return false;
+        }
+        field->assign(metadata, position, length);
+        position += length;
+    }
+
+    std::vector<char> table(static_cast<size_t>(chunk_count) * chunk_entry_size);
+    if (!in.read(table.data(), table.size()))
+    {
+        return false;
+    }
+    info.chunks.resize(chunk_count);
+    uint64_t raw_total = 0;
+    for (size_t i = 0; i < info.chunks.size(); ++i)
+    {
+        const char* entry = table.data() + i * chunk_entry_size;
+        info.chunks[i].offset = get_u64(entry);
+        info.chunks[i].size = get_u64(entry + 8);
+        if (info.version >= 2)
+        {
+            info.chunks[i].plain_checksum = get_u32(entry + 16);
+            info.chunks[i].stored_checksum = get_u32(entry + 20);
+        }
+
+        // every chunk but the last holds exactly chunk_size payload bytes, which is what lets a reader
+        // find the chunk for any payload position without walking the table
+        const uint64_t expected_raw_size = std::min<uint64_t>(info.chunk_size, info.payload_size - static_cast<uint64_t>(i) * info.chunk_size);
+        info.chunks[i].raw_size = static_cast<uint32_t>(expected_raw_size);
+        if (info.version >= 3)
+        {
+            info.chunks[i].raw_size = get_u32(entry + 24);
+            info.chunks[i].flags = get_u32(entry + 28);
+        }
+        const bool compressed = (info.chunks[i].flags & container_chunk_compressed) != 0;
+        if (info.chunks[i].raw_size != expected_raw_size || (!compressed && info.chunks[i].size != expected_raw_size))
+        {
+            return false;
+        }
+        // the stored bytes lie inside the file, and a compressed chunk cannot claim more raw bytes than
+        // the codec could possibly expand it to, which bounds what decompression allocates
+        if (info.chunks[i].size > file_length || info.chunks[i].offset > file_length - info.chunks[i].size
+            || (compressed && info.chunks[i].raw_size > lz_max_raw_size(info.chunks[i].size)))
+        {
+            return false;
+        }
+        raw_total += info.chunks[i].raw_size;
+    }
+    // together the chunks hold the whole payload and nothing more
+    if (raw_total != info.payload_size)
+    {
+        return false;
+    }
+    info.has_checksums = info.version >= 2;
+    return true;
+}
+
+/// <summary>
+/// seek straight to one chunk and read its stored bytes
+/// </summary>
+bool read_container_chunk(std::istream& in, const container_info& info, size_t index, std::vector<char>& data)
+{
+    assert(index < info.chunks.size());
+
+    const container_chunk& chunk = info.chunks[index];
+    data.resize(static_cast<size_t>(chunk.size));
+    in.seekg(static_cast<std::streamoff>(chunk.offset));
+    return static_cast<bool>(in.read(data.data(), data.size()));
+}
+
+/// <summary>
+/// key phase of the first stored byte of a chunk: the raw payload position where the chunk starts
+/// </summary>
+size_t container_chunk_key_offset(const container_info& info, size_t index, const std::string& key)
+{
+    return static_cast<size_t>((static_cast<uint64_t>(index) * info.chunk_size) % key.length());
+}
+
+/// <summary>
+/// turn the raw bytes of one chunk into its stored form: compressed when the codec asks for it and that
+/// saves space, then encrypted with both checksums taken in the same pass. fills in every field of
+/// the table entry except the file offset.
+/// </summary>
+void encode_container_chunk(const container_info& info, size_t index, const std::string& key, const std::vector<char>& raw, std::vector<char>& stored, container_chunk& chunk)
+{
+    chunk.raw_size = static_cast<uint32_t>(raw.size());
+    chunk.flags = 0;
+    stored.resize(raw.size());
+    size_t stored_size = 0;
+    if (info.codec == container_codec_lz && raw.size() > 1)
+    { // only accept output that is strictly smaller, incompressible chunks stay raw
+        stored_size = lz_compress(raw.data(), raw.size(), stored.data(), raw.size() - 1);
+    }
+    if (stored_size > 0)
+    {
+        chunk.flags |= container_chunk_compressed;
+        stored.resize(stored_size);
+    }
+    else
+    {
+        std::copy(raw.begin(), raw.end(), stored.begin());
+    }
+
+    chunk.size = stored.size();
+    chunk.plain_checksum = 0;
+    chunk.stored_checksum = 0;
+    xor_transform_checksum(stored.data(), stored.data(), stored.size(), key.data(), key.length(), container_chunk_key_offset(info, index, key),
+        chunk.plain_checksum, chunk.stored_checksum);
+}
+
+/// <summary>
+/// the reverse of encode_container_chunk. decrypts stored in place, verifying the checksums in the same
+/// pass when the container has them, and decompresses into raw when the chunk was compressed.
+/// </summary>
+/// <param name="error">receives a description of what went wrong</param>
+/// <returns>true when raw holds the original chunk bytes</returns>
+bool decode_container_chunk(const container_info& info, size_t index, const std::string& key, std::vector<char>& stored, std::vector<char>& raw, std::string& error)
+{
+    const container_chunk& chunk = info.chunks[index];
+
+    // verifying costs no extra pass: both checksums are taken while the chunk is decrypted
+    uint32_t stored_checksum = 0;
+    uint32_t plain_checksum = 0;
+    xor_transform_checksum(stored.data(), stored.data(), stored.size(), key.data(), key.length(), container_chunk_key_offset(info, index, key),
+        stored_checksum, plain_checksum);
+    if (info.has_checksums && stored_checksum != chunk.stored_checksum)
+    {
+        error = "chunk " + std::to_string(index) + " is corrupt";
+        return false;
+    }
+    if (info.has_checksums && plain_checksum != chunk.plain_checksum)
+    {
+        error = "chunk " + std::to_string(index) + " did not decrypt to the original data, check the key";
+        return false;
+    }
+
+    if ((chunk.flags & container_chunk_compressed) == 0)
+    {
+        raw.swap(stored);
+        return true;
+    }
+    raw.resize(chunk.raw_size);
+    if (!lz_decompress(stored.data(), stored.size(), raw.data(), raw.size()))
+    {
+        error = "chunk " + std::to_string(index) + " failed to decompress";
+        return false;
+    }
+    return true;
+}
+
+/// <summary>
+/// encrypt a plain input file into a binary container, one chunk at a time.
+/// every chunk is encrypted at its position in the whole payload, so chunks can be decrypted independently.
+/// chunks are read and written in order, and compressed and encrypted a batch at a time on the shared pool.
+/// </summary>
+/// <param name="input_filename">plain file to read, its first line is the student name</param>
+/// <param name="output_filename">container to write</param>
+/// <param name="key">key to use in encryption</param>
+/// <param name="chunk_size">payload bytes per chunk</param>
+/// <param name="codec">container_codec_none, or container_codec_lz to compress ahead of encryption</param>
+/// <returns>true on success</returns>
+bool container_encrypt_file(const std::string& input_filename, const std::string& output_filename, const std::string& key, uint32_t chunk_size, uint32_t codec)
+{
+    assert(!key.empty());
+    assert(chunk_size > 0);
+
+    std::error_code error;
+    const uint64_t payload_size = std::filesystem::file_size(input_filename, error);
+    std::ifstream in(input_filename, std::ios::binary);
+    if (error || !in)
+    {
+        std::cout << "Failed to open " << input_filename << std::endl;
+        return false;
+    }
+    if (same_file(input_filename, output_filename))
+    {
+        std::cout << "Input and output are the same file: " << input_filename << std::endl;
+        return false;
+    }
+
+    container_info info;
+    info.version = container_version;
+    info.has_checksums = true;
+    info.codec = codec;
+    info.chunk_size = chunk_size;
+    info.payload_size = payload_size;
+    info.key = key;
+    if (!read_bounded_line(in, info.student_name))
+    { // no newline within the limit, so no name, same rules as open_stream_files
+        info.student_name.clear();
+    }
+    in.clear();
+    in.seekg(0);
+    char date[16];
+    const std::tm tm = current_local_time();
+    info.date.assign(date, std::strftime(date, sizeof(date), "%Y-%m-%d", &tm));
+    info.chunks.resize(static_cast<size_t>((payload_size + chunk_size - 1) / chunk_size));
+
+    std::ofstream out(output_filename, std::ios::binary);
+    if (!out)
+    {
+        std::cout << "Failed to create " << output_filename << std::endl;
+        return false;
+    }
+
+    // reserve room for the prefix, fill in the chunks, then come back and write the real table
+    const std::string placeholder = format_container_prefix(info);
+    out.write(placeholder.data(), placeholder.length());
+
+    thread_pool& pool = default_thread_pool();
+    const size_t batch_size = std::max<size_t>(1, pool.size() * 2);
+    std::vector<std::vector<char>> raw(batch_size);
+    std::vector<std::vector<char>> stored(batch_size);
+    uint64_t offset = placeholder.length();
+    uint64_t position = 0;
+    for (size_t first = 0; first < info.chunks.size(); first += batch_size)
+    {
+        const size_t count = std::min(batch_size, info.chunks.size() - first);
+        for (size_t j = 0; j < count; ++j)
+        {
+            raw[j].resize(chunk_size);
+            in.read(raw[j].data(), raw[j].size());
+            raw[j].resize(static_cast<size_t>(in.gcount()));
+            position += raw[j].size();
+        }
+
+        pool.parallel_for(count, [&](size_t j) {
+            encode_container_chunk(info, first + j, key, raw[j], stored[j], info.chunks[first + j]);
+        });
+
+        for (size_t j = 0; j < count; ++j)
+        {
+            out.write(stored[j].data(), stored[j].size());
+            info.chunks[first + j].offset = offset;
+            offset += stored[j].size();
+        }
+    }
+    if (position != payload_size)
+    {
+        std::cout << input_filename << " changed size while it was being read" << std::endl;
+        return false;
+    }
+
+    const std::string prefix = format_container_prefix(info);
+    assert(prefix.length() == placeholder.length());
+    out.seekp(0);
+    out.write(prefix.data(), prefix.length());
+
+    if (in.bad() || !out)
+    {
+        std::cout << "I/O error while writing " << output_filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/// <summary>
+/// decrypt a container or a text data file into a text data file, as save_data_file writes them.
+/// containers are decrypted chunk by chunk through the chunk table and, from version 2, checked against
+/// the recorded checksums in the same pass. text files go through the original
+/// read_file / get_student_name / encrypt_decrypt path.
+/// </summary>
+/// <param name="input_filename">container or text data file</param>
+/// <param name="output_filename">text data file to write</param>
+/// <param name="key">key to use in decryption</param>
+/// <returns>true on success</returns>
+bool container_decrypt_file(const std::string& input_filename, const std::string& output_filename, const std::string& key)
+{
+    assert(!key.empty());
+
+    std::ifstream in(input_filename, std::ios::binary);
+    if (!in)
+    {
+        std::cout << "Failed to open " << input_filename << std::endl;
+        return false;
+    }
+    if (same_file(input_filename, output_filename))
+    {
+        std::cout << "Input and output are the same file: " << input_filename << std::endl;
+        return false;
+    }
+
+    if (!is_container(in))
+    {
+        in.close();
+        const std::string file_data = read_file(input_filename);
+        const std::string student_name = get_student_name(file_data);
+        std::string_view name_view;
+        std::string_view body;
+        if (!split_data_file(file_data, name_view, body))
+        {
+            std::cout << "Missing data file header in " << input_filename << std::endl;
+            return false;
+        }
+        const std::string decrypted = body.empty() ? std::string() : encrypt_decrypt(std::string(body), key);
+        std::vector<char> header(format_data_header(nullptr, 0, student_name, key));
+        format_data_header(header.data(), header.size(), student_name, key);
+        if (!write_data_file(output_filename.c_str(), std::string_view(header.data(), header.size()), decrypted))
+        {
+            std::cout << "Failed to write " << output_filename << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    container_info info;
+    if (!read_container_info(in, info))
+    {
+        std::cout << input_filename << " is not a valid container" << std::endl;
+        return false;
+    }
+
+    std::ofstream out(output_filename);
+    if (!out)
+    {
+        std::cout << "Failed to create " << output_filename << std::endl;
+        return false;
+    }
+    write_data_header(out, info.student_name, key);
+
+    // read in order, decode a batch at a time on the pool, write in order
+    thread_pool& pool = default_thread_pool();
+    const size_t batch_size = std::max<size_t>(1, pool.size() * 2);
+    std::vector<std::vector<char>> stored(batch_size);
+    std::vector<std::vector<char>> raw(batch_size);
+    std::vector<std::string> errors(batch_size);
+    for (size_t first = 0; first < info.chunks.size(); first += batch_size)
+    {
+        const size_t count = std::min(batch_size, info.chunks.size() - first);
+        for (size_t j = 0; j < count; ++j)
+        {
+            if (!read_container_chunk(in, info, first + j, stored[j]))
+            {
+                std::cout << "Failed to read chunk " << first + j << " of " << input_filename << std::endl;
+                return false;
+            }
+        }
+
+        pool.parallel_for(count, [&](size_t j) {
+            errors[j].clear();
+            decode_container_chunk(info, first + j, key, stored[j], raw[j], errors[j]);
+        });
+
+        for (size_t j = 0; j < count; ++j)
+        {
+            if (!errors[j].empty())
+            {
+                std::cout << input_filename << ": " << errors[j] << std::endl;
+                return false;
+            }
+            out.write(raw[j].data(), raw[j].size());
+        }
+    }
+
+    if (!out)
+    {
+        std::cout << "I/O error while writing " << output_filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/// <summary>
+/// decrypt only bytes [begin, end) of the body of an encrypted data file or container.
+/// the key stream depends only on position, so nothing before begin is read; a container also
+/// skips every chunk outside the range through its chunk table.
+/// positions count bytes as stored in the file, so text data files written on Windows (where the
+/// body went through newline translation) only line up when the body holds no newlines.
+/// </summary>
+/// <param name="filename">text data file or container</param>
+/// <param name="key">key used to encrypt the file</param>
+/// <param name="begin">first body byte wanted</param>
+/// <param name="end">one past the last body byte wanted, clamped to the body length</param>
+/// <param name="output">receives the decrypted bytes</param>
+/// <returns>true on success</returns>
+bool decrypt_range(const std::string& filename, const std::string& key, uint64_t begin, uint64_t end, std::string& output)
+{
+    assert(!key.empty());
+
+    output.clear();
+    if (begin > end)
+    {
+        return false;
+    }
+
+    std::ifstream in(filename, std::ios::binary);
+    if (!in)
+    {
+        return false;
+    }
+
+    if (is_container(in))
+    {
+        container_info info;
+        if (!read_container_info(in, info))
+        {
+            return false;
+        }
+        end = std::min(end, info.payload_size);
+        if (begin >= end)
+        {
+            return true;
+        }
+
+        output.resize(static_cast<size_t>(end - begin));
+        std::vector<char> stored;
+        std::vector<char> raw;
+        std::string error;
+        uint64_t position = begin;
+        while (position < end)
+        {
+            // chunks hold chunk_size payload bytes each, so the chunk and the offset inside it are direct
+            const size_t index = static_cast<size_t>(position / info.chunk_size);
+            const uint64_t offset_in_chunk = position % info.chunk_size;
+            const container_chunk& chunk = info.chunks[index];
+            const uint64_t count = std::min<uint64_t>(end - position, chunk.raw_size - offset_in_chunk);
+            char* const destination = &output[static_cast<size_t>(position - begin)];
+            if ((chunk.flags & container_chunk_compressed) != 0)
+            { // a compressed chunk can only be decoded whole, so the slice is taken from the decoded chunk
+                if (!read_container_chunk(in, info, index, stored) || !decode_container_chunk(info, index, key, stored, raw, error))
+                {
+                    output.clear();
+                    return false;
+                }
+                std::memcpy(destination, raw.data() + offset_in_chunk, static_cast<size_t>(count));
+            }
+            else
+            {
+                in.seekg(static_cast<std::streamoff>(chunk.offset + offset_in_chunk));
+                if (!in.read(destination, static_cast<std::streamsize>(count)))
+                {
+                    output.clear();
+                    return false;
+                }
+                // start the key at the phase of the first byte, exactly where a full decrypt would be
+                xor_transform(destination, destination, static_cast<size_t>(count), key.data(), key.length(), static_cast<size_t>(position % key.length()));
+            }
+            position += count;
+        }
+        return true;
+    }
+    else
+    {
+        // skip the three header lines to find where the body starts
+        for (int line = 0; line < 3; ++line)
+        {
+            in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        }
+        if (!in)
+        {
+            return false;
+        }
+        const uint64_t body_start = static_cast<uint64_t>(in.tellg());
+        in.seekg(0, std::ios::end);
+        const uint64_t body_length = static_cast<uint64_t>(in.tellg()) - body_start;
+        end = std::min(end, body_length);
+        if (begin >= end)
+        {
+            return true;
+        }
+
+        output.resize(static_cast<size_t>(end - begin));
+        in.seekg(static_cast<std::streamoff>(body_start + begin));
+        if (!in.read(&output[0], static_cast<std::streamsize>(output.length())))
+        {
+            output.clear();
+            return false;
+        }
+    }
+
+    // start the key at the phase of the first byte, exactly where a full decrypt would be
+    xor_transform(output.data(), &output[0], output.length(), key.data(), key.length(), static_cast<size_t>(begin % key.length()));
+    return true;
+}
+
+/// <summary>
+/// display the header, metadata and chunk table of a container
+/// </summary>
+bool print_container_info(const std::string& filename)
+{
+    std::ifstream in(filename, std::ios::binary);
+    container_info info;
+    if (!in || !read_container_info(in, info))
+    {
+        std::cout << filename << " is not a valid container" << std::endl;
+        return false;
+    }
+
+    std::cout << filename << ": version " << info.version << ", " << info.payload_size << " bytes in "
+        << info.chunks.size() << " chunks of " << info.chunk_size << ", codec " << (info.codec == container_codec_lz ? "lz" : "none") << std::endl;
+    std::cout << "Student: " << info.student_name << std::endl;
+    std::cout << "Date: " << info.date << std::endl;
+    std::cout << "Key: " << info.key << std::endl;
+    for (size_t i = 0; i < info.chunks.size(); ++i)
+    {
+        std::cout << "  chunk " << i << ": offset " << info.chunks[i].offset << ", " << info.chunks[i].size << " bytes";
+        if ((info.chunks[i].flags & container_chunk_compressed) != 0)
+        {
+            std::cout << " compressed from " << info.chunks[i].raw_size;
+        }
+        if (info.has_checksums)
+        {
+            std::cout << std::hex << ", plain crc32c " << info.chunks[i].plain_checksum << ", stored crc32c " << info.chunks[i].stored_checksum << std::dec;
+        }
+        std::cout << '\n';
+    }
+    return true;
+}
+
+/// <summary>
+/// timing for one file of a batch run
+/// </summary>
+struct batch_file_result
+{
+    std::string input_filename;
+    std::string output_filename;
+    size_t bytes = 0;
+    double seconds = 0.0;
+    bool succeeded = false;
+};
+
+/// <summary>
+/// bytes per second expressed in MB/s, guarding against zero durations on tiny files
+/// </summary>
+double megabytes_per_second(size_t bytes, double seconds)
+{
+    return seconds > 0.0 ? static_cast<double>(bytes) / seconds / 1.0e6 : 0.0;
+}
+
+/// <summary>
+/// list the files a batch run should process. source is either a directory, whose regular files are
+/// taken in name order, or a manifest text file with one input path per line.
+/// </summary>
+bool list_batch_inputs(const std::string& source, std::vector<std::string>& inputs)
+{
+    namespace fs = std::filesystem;
+
+    inputs.clear();
+    std::error_code error;
+    if (fs::is_directory(source, error))
+    {
+        for (const auto& entry : fs::directory_iterator(source, error))
+        {
+            if (entry.is_regular_file(error))
+            {
+                inputs.push_back(entry.path().string());
+            }
+        }
+        std::sort(inputs.begin(), inputs.end());
+        return !error;
+    }
+
+    std::ifstream manifest(source);
+    if (!manifest)
+    {
+        return false;
+    }
+    std::string line;
+    while (std::getline(manifest, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+        if (!line.empty())
+        {
+            inputs.push_back(line);
+        }
+    }
+    return true;
+}
+
+/// <summary>
+/// read, transform and save one file of a batch through the allocation free path.
+/// equivalent to read_file -> encrypt_decrypt -> save_data_file, with the output in binary mode.
+/// </summary>
+batch_file_result batch_process_file(const std::string& input_filename, const std::string& output_filename, const std::string& key, bool input_has_header)
+{
+    batch_file_result result;
+    result.input_filename = input_filename;
+    result.output_filename = output_filename;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    // buffers come from the pool, so steady state batch runs do not touch the heap, and they are wiped
+    // on the way back so no plaintext outlives the file
+    pooled_buffer file_buffer;
+    pooled_buffer header_buffer;
+
+    if (read_file_into(input_filename.c_str(), file_buffer))
+    {
+        const std::string_view file_data(file_buffer.data(), file_buffer.size());
+        std::string_view student_name = get_student_name_view(file_data);
+        std::string_view body = file_data;
+        if (!input_has_header || split_data_file(file_data, student_name, body))
+        { // the name may be a view into the body, so format the header before transforming it
+            size_t header_length = format_data_header(header_buffer.data(), header_buffer.size(), student_name, key);
+            if (header_length > header_buffer.size())
+            {
+                header_buffer.resize(header_length);
+                header_length = format_data_header(header_buffer.data(), header_buffer.size(), student_name, key);
+            }
+
+            // body is a view into file_buffer, so it can be transformed where it sits
+            char* const body_data = file_buffer.data() + (body.data() - file_data.data());
+            encrypt_decrypt_in_place(body_data, body.length(), key);
+
+            result.bytes = body.length();
+            result.succeeded = write_data_file(output_filename.c_str(), std::string_view(header_buffer.data(), header_length), body);
+        }
+    }
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+/// <summary>
+/// encrypt or decrypt many files at once on the shared pool, then report per file and aggregate throughput
+/// </summary>
+/// <param name="source">directory or manifest file naming the inputs</param>
+/// <param name="output_directory">where the outputs go, named after their inputs</param>
+/// <param name="key">key to use in encryption / decryption</param>
+/// <param name="input_has_header">true when the inputs are saved data files</param>
+/// <returns>true when every file succeeded</returns>
+bool batch_encrypt_decrypt(const std::string& source, const std::string& output_directory, const std::string& key, bool input_has_header)
+{
+    namespace fs = std::filesystem;
+
+    std::vector<std::string> inputs;
+    if (!list_batch_inputs(source, inputs))
+    {
+        std::cout << "Failed to list input files from " << source << std::endl;
+        return false;
+    }
+
+    // outputs are named after their inputs, so two inputs with the same file name would be written to the
+    // same output by two pool threads at once, and an input in the output directory would be overwritten
+    std::vector<std::pair<std::string, size_t>> outputs(inputs.size());
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        outputs[i] = std::make_pair((fs::path(output_directory) / fs::path(inputs[i]).filename()).string(), i);
+    }
+    std::vector<std::pair<std::string, size_t>> sorted_outputs(outputs);
+    std::sort(sorted_outputs.begin(), sorted_outputs.end());
+    for (size_t i = 1; i < sorted_outputs.size(); ++i)
+    {
+        if (sorted_outputs[i].first == sorted_outputs[i - 1].first)
+        {
+            std::cout << "Inputs " << inputs[sorted_outputs[i - 1].second] << " and " << inputs[sorted_outputs[i].second]
+                << " would both be written to " << sorted_outputs[i].first << std::endl;
+            return false;
+        }
+    }
+
+    std::error_code error;
+    if (fs::exists(output_directory, error))
+    {
+        for (const std::string& input : inputs)
+        {
+            const fs::path input_directory = fs::path(input).has_parent_path() ? fs::path(input).parent_path() : fs::path(".");
+            if (fs::equivalent(input_directory, output_directory, error))
+            {
+                std::cout << "Output directory " << output_directory << " is the directory of input " << input << std::endl;
+                return false;
+            }
+        }
+    }
+
+    fs::create_directories(output_directory, error);
+    if (error)
+    {
+        std::cout << "Failed to create " << output_directory << ". ERROR = " << error.message() << std::endl;
+        return false;
+    }
+
+    std::vector<batch_file_result> results(inputs.size());
+    const auto start = std::chrono::steady_clock::now();
+    default_thread_pool().parallel_for(inputs.size(), [&](size_t i) {
+        results[i] = batch_process_file(inputs[i], outputs[i].first, key, input_has_header);
+    });
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t total_bytes = 0;
+    size_t failures = 0;
+    std::cout << std::fixed << std::setprecision(2);
+    for (const auto& result : results)
+    {
+        if (result.succeeded)
+        {
+            total_bytes += result.bytes;
+            std::cout << result.input_filename << " -> " << result.output_filename << ": " << result.bytes << " bytes in "
+                << result.seconds * 1.0e6 << " us (" << megabytes_per_second(result.bytes, result.seconds) << " MB/s)" << '\n';
+        }
+        else
+        {
+            ++failures;
+            std::cout << result.input_filename << ": FAILED" << '\n';
+        }
+    }
+
+    std::cout << "Processed " << results.size() - failures << " of " << results.size() << " files, " << total_bytes << " bytes in "
+        << seconds << " s on " << default_thread_pool().size() << " threads: "
+        << megabytes_per_second(total_bytes, seconds) << " MB/s, "
+        << (seconds > 0.0 ? static_cast<double>(results.size()) / seconds : 0.0) << " files/s" << std::endl;
+
+    size_t allocated = 0;
+    size_t reused = 0;
+    size_t lock_failures = 0;
+    default_buffer_pool().statistics(allocated, reused, lock_failures);
+    std::cout << "Buffers: " << allocated << " allocated, " << reused << " reused";
+    if (default_buffer_pool_settings().lock_memory)
+    {
+        std::cout << ", " << lock_failures << " could not be locked";
+    }
+    std::cout << std::endl;
+
+    return failures == 0;
+}
+
+/// <summary>
+/// encrypt one input file for many keys: the file is read once, transformed under every key in one pass,
+/// and the outputs are saved at the same time on the shared pool. output k is named output_prefix.k,
+/// counting keys from 1, and holds what encrypt_decrypt and save_data_file would make, written in binary
+/// mode like the batch outputs.
+/// </summary>
+/// <param name="input_filename">file to read, a missing file is an error rather than the sample text</param>
+/// <param name="output_prefix">path the output names are made from</param>
+/// <param name="keys">keys to use, none empty</param>
+/// <returns>true when every output was written</returns>
+bool fan_out_encrypt_file(const std::string& input_filename, const std::string& output_prefix, const std::vector<std::string>& keys)
+{
+    std::string source_string;
+    if (!read_file_into(input_filename.c_str(), source_string))
+    {
+        std::cout << "Failed to read " << input_filename << std::endl;
+        return false;
+    }
+    const std::string_view student_name = get_student_name_view(source_string);
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::string> encrypted_strings;
+    if (!encrypt_decrypt_fan_out(source_string, keys, encrypted_strings))
+    {
+        std::cout << "The key must not be empty." << std::endl;
+        return false;
+    }
+    const double transform_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<char> succeeded(keys.size(), 0);
+    default_thread_pool().parallel_for(keys.size(), [&](size_t k) {
+        const std::string output_filename = output_prefix + "." + std::to_string(k + 1);
+        std::vector<char> header(format_data_header(nullptr, 0, student_name, keys[k]));
+        format_data_header(header.data(), header.size(), student_name, keys[k]);
+        succeeded[k] = write_data_file(output_filename.c_str(), std::string_view(header.data(), header.size()), encrypted_strings[k]) ? 1 : 0;
+    });
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const size_t failures = static_cast<size_t>(std::count(succeeded.begin(), succeeded.end(), 0));
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Encrypted " << input_filename << " (" << source_string.length() << " bytes) under " << keys.size() << " keys in "
+        << transform_seconds * 1.0e3 << " ms (" << megabytes_per_second(source_string.length() * keys.size(), transform_seconds)
+        << " MB/s of output), saved in " << seconds * 1.0e3 << " ms total, " << failures << " failed" << std::endl;
+    return failures == 0;
+}
+
+#if !defined(_WIN32)
+
+// the resident service protocol. a request is a fixed header and then its payload, integers little endian:
+//   request: u32 op, u32 key length, u64 key phase, u64 data length, then the key bytes and the data bytes
+//   response: u32 status, u32 reserved, u64 data length, then the data bytes
+// a connection carries one request at a time, clients that want more in flight open more connections.
+// encryption and decryption are the same transform, so both are service_op_transform.
+const uint32_t service_op_transform = 1;
+const uint32_t service_op_stats = 2;
+const uint32_t service_op_shutdown = 3;
+const uint32_t service_status_ok = 0;
+const uint32_t service_status_bad_request = 1;
+const size_t service_request_header_size = 24;
+const size_t service_response_header_size = 16;
+
+// limits that keep one misbehaving client from making the service allocate without bound
+const size_t service_max_key_length = 64 * 1024;
+const size_t service_max_data_length = size_t(256) * 1024 * 1024;
+// connections served at once, each with a thread and a buffer of up to service_max_data_length.
+// connections beyond this are closed as soon as they are accepted.
+const size_t service_max_connections = 64;
+
+// buffer each connection starts with. it only ever grows, and is reused for every request on the connection.
+const size_t service_initial_buffer_size = 64 * 1024;
+
+// most requests handed to the pool together
+const size_t service_max_batch = 64;
+
+// latency samples kept for the percentile report, older ones are overwritten
+const size_t service_latency_window = 1 << 16;
+
+// how often the accept loop looks up from waiting to check for a shutdown request
+const int service_poll_interval_ms = 100;
+
+/// <summary>
+/// the value at fraction (0 to 1) of the way through sorted samples, nearest rank
+/// </summary>
+double percentile(const std::vector<double>& sorted, double fraction)
+{
+    assert(!sorted.empty());
+    return sorted[static_cast<size_t>(fraction * static_cast<double>(sorted.size() - 1) + 0.5)];
+}
+
+/// <summary>
+/// read exactly length bytes from a socket
+/// </summary>
+/// <returns>false when the peer closed the connection first or the read failed</returns>
+bool read_exact(int fd, char* data, size_t length)
+{
+    while (length > 0)
+    {
+        const ssize_t count = ::read(fd, data, length);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return false;
+        }
+        data += count;
+        length -= static_cast<size_t>(count);
+    }
+    return true;
+}
+
+/// <summary>
+/// write every byte of parts to a socket in as few gathered writes as the kernel allows.
+/// parts is updated as it is consumed.
+/// </summary>
+bool write_exact(int fd, iovec* parts, int part_count)
+{
+    while (part_count > 0)
+    {
+        ssize_t count = ::writev(fd, parts, part_count);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count < 0)
+        {
+            return false;
+        }
+        // a short write leaves us part way through one of the pieces
+        while (part_count > 0 && static_cast<size_t>(count) >= parts->iov_len)
+        {
+            count -= static_cast<ssize_t>(parts->iov_len);
+            ++parts;
+            --part_count;
+        }
+        if (part_count > 0)
+        {
+            parts->iov_base = static_cast<char*>(parts->iov_base) + count;
+            parts->iov_len -= static_cast<size_t>(count);
+        }
+    }
+    return true;
+}
+
+/// <summary>
+/// fill in a unix domain socket address
+/// </summary>
+/// <returns>false when the path does not fit</returns>
+bool make_socket_address(const std::string& socket_path, sockaddr_un& address)
+{
+    std::memset(&address, 0, sizeof(address));
+    if (socket_path.empty() || socket_path.length() >= sizeof(address.sun_path))
+    {
+        return false;
+    }
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, socket_path.c_str(), socket_path.length() + 1);
+    return true;
+}
+
+/// <summary>
+/// one request in flight. each connection owns one and reuses it, so after the first few requests
+/// a steady client costs the service no allocations.
+/// </summary>
+struct service_request
+{
+    uint32_t op = 0;
+    uint32_t status = service_status_ok;
+    uint64_t key_offset = 0;
+    std::string key;
+    pooled_buffer data; // grows to the largest request seen, length is the part in use
+    size_t length = 0;
+    std::string report;
+    std::chrono::steady_clock::time_point received;
+
+    std::mutex mutex;
+    std::condition_variable finished;
+    bool done = false;
+};
+
+/// <summary>
+/// resident encryption service on a unix domain socket. each client connection has a thread that reads
+/// framed requests and writes the responses, and a single dispatcher thread takes whatever requests are
+/// waiting as one batch and runs it on the shared, already warm pool.
+/// </summary>
+class encryption_service
+{
+public:
+    /// <summary>
+    /// serve on socket_path until a client sends service_op_shutdown
+    /// </summary>
+    /// <returns>true when the service started and shut down cleanly</returns>
+    bool run(const std::string& socket_path);
+
+private:
+    struct connection
+    {
+        int fd = -1;
+        std::thread thread;
+        std::atomic<bool> finished{ false };
+        service_request request;
+    };
+
+    void serve_connection(connection& client);
+    void dispatch();
+    void process_batch(const std::vector<service_request*>& batch);
+    void reap_connections(bool all);
+    std::string format_report() const;
+
+    blocking_queue<service_request*> queue_;
+    std::atomic<bool> stopping_{ false };
+    std::atomic<uint64_t> refused_connections_{ 0 };
+    std::mutex connections_mutex_;
+    std::vector<std::unique_ptr<connection>> connections_;
+
+    // only the dispatcher thread touches these, so they need no lock
+    std::vector<double> latencies_;
+    size_t latency_next_ = 0;
+    uint64_t requests_ = 0;
+    uint64_t batches_ = 0;
+    uint64_t bytes_ = 0;
+};
+
+bool encryption_service::run(const std::string& socket_path)
+{
+    sockaddr_un address;
+    if (!make_socket_address(socket_path, address))
+    {
+        std::cout << "Socket path " << socket_path << " is empty or too long" << std::endl;
+        return false;
+    }
+
+    // a socket left behind by an earlier run would make bind fail, anything else at the path is not ours to remove
+    struct stat existing;
+    if (::lstat(socket_path.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode))
+    {
+        ::unlink(socket_path.c_str());
+    }
+
+    const int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || ::bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || ::listen(listener, SOMAXCONN) != 0)
+    {
+        std::cout << "Failed to listen on " << socket_path << ". ERROR = " << std::strerror(errno) << std::endl;
+        if (listener >= 0)
+        {
+            ::close(listener);
+        }
+        return false;
+    }
+
+    // a client that hangs up mid response must not take the service down with it
+    std::signal(SIGPIPE, SIG_IGN);
+
+    // pay for the pool and the kernel selection now rather than on the first request
+    thread_pool& pool = default_thread_pool();
+    char warm_up[64] = {};
+    xor_transform(warm_up, warm_up, sizeof(warm_up), "key", 3, 0);
+    latencies_.reserve(service_latency_window);
+
+    std::cout << "Listening on " << socket_path << " with " << pool.size() << " worker threads" << std::endl;
+
+    std::thread dispatcher([this]() { dispatch(); });
+    while (!stopping_)
+    {
+        pollfd waiting = { listener, POLLIN, 0 };
+        const int ready = ::poll(&waiting, 1, service_poll_interval_ms);
+        reap_connections(false);
+        if (ready <= 0)
+        {
+            continue;
+        }
+        const int fd = ::accept(listener, nullptr, nullptr);
+        if (fd < 0)
+        {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        if (connections_.size() >= service_max_connections)
+        {
+            ::close(fd);
+            ++refused_connections_;
+            continue;
+        }
+        connections_.push_back(std::make_unique<connection>());
+        connection& client = *connections_.back();
+        client.fd = fd;
+        client.thread = std::thread([this, &client]() { serve_connection(client); });
+    }
+
+    ::close(listener);
+    ::unlink(socket_path.c_str());
+
+    // wake every connection thread out of its read, let any request already queued finish, then stop the dispatcher
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        for (auto& client : connections_)
+        {
+            ::shutdown(client->fd, SHUT_RDWR);
+        }
+    }
+    reap_connections(true);
+    queue_.close();
+    dispatcher.join();
+
+    std::cout << format_report() << std::endl;
+    return true;
+}
+
+/// <summary>
+/// join and close connections whose clients have gone, or all of them when shutting down
+/// </summary>
+void encryption_service::reap_connections(bool all)
+{
+    std::vector<std::unique_ptr<connection>> finished;
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        auto first_finished = std::stable_partition(connections_.begin(), connections_.end(),
+            [all](const std::unique_ptr<connection>& client) { return !all && !client->finished; });
+        std::move(first_finished, connections_.end(), std::back_inserter(finished));
+        connections_.erase(first_finished, connections_.end());
+    }
+    // joined outside the lock, a connection thread may still be waiting on its last response
+    for (auto& client : finished)
+    {
+        client->thread.join();
+        ::close(client->fd);
+    }
+}
+
+void encryption_service::serve_connection(connection& client)
+{
+    service_request& request = client.request;
+    request.data.resize(service_initial_buffer_size);
+
+    char header[service_request_header_size];
+    while (read_exact(client.fd, header, sizeof(header)))
+    {
+        request.op = get_u32(header);
+        const size_t key_length = get_u32(header + 4);
+        request.key_offset = get_u64(header + 8);
+        const uint64_t length = get_u64(header + 16);
+        if (key_length > service_max_key_length || length > service_max_data_length)
+        { // the rest of the stream cannot be trusted to line up with a frame any more
+            break;
+        }
+
+        request.key.resize(key_length);
+        if (request.data.size() < length)
+        {
+            request.data.resize(static_cast<size_t>(length));
+        }
+        request.length = static_cast<size_t>(length);
+        if (!read_exact(client.fd, &request.key[0], key_length) || !read_exact(client.fd, request.data.data(), request.length))
+        {
+            break;
+        }
+
+        request.received = std::chrono::steady_clock::now();
+        request.report.clear();
+        const bool valid = request.op == service_op_stats || request.op == service_op_shutdown
+            || (request.op == service_op_transform && !request.key.empty());
+        request.status = valid ? service_status_ok : service_status_bad_request;
+        if (valid)
+        {
+            {
+                std::lock_guard<std::mutex> lock(request.mutex);
+                request.done = false;
+            }
+            queue_.push(&request);
+            std::unique_lock<std::mutex> lock(request.mutex);
+            request.finished.wait(lock, [&request]() { return request.done; });
+        }
+
+        // transforms send the data back, stats and shutdown send the report
+        std::string_view payload;
+        if (request.status == service_status_ok)
+        {
+            payload = request.op == service_op_transform ? std::string_view(request.data.data(), request.length) : std::string_view(request.report);
+        }
+        char response[service_response_header_size];
+        store_le32(response, request.status);
+        store_le32(response + 4, 0);
+        store_le32(response + 8, static_cast<uint32_t>(payload.length()));
+        store_le32(response + 12, static_cast<uint32_t>(static_cast<uint64_t>(payload.length()) >> 32));
+        iovec parts[2] = {
+            { response, sizeof(response) },
+            { const_cast<char*>(payload.data()), payload.length() },
+        };
+        const bool written = write_exact(client.fd, parts, 2);
+        if (request.op == service_op_shutdown && request.status == service_status_ok)
+        { // only once the report is written may the accept loop stop and close the other connections
+            stopping_ = true;
+            break;
+        }
+        if (!written)
+        {
+            break;
+        }
+    }
+    client.finished = true;
+}
+
+void encryption_service::dispatch()
+{
+    std::vector<service_request*> batch;
+    batch.reserve(service_max_batch);
+    service_request* request = nullptr;
+    while (queue_.pop(request))
+    {
+        // whatever else arrived while the last batch ran goes along with this one
+        batch.clear();
+        batch.push_back(request);
+        while (batch.size() < service_max_batch && queue_.try_pop(request))
+        {
+            batch.push_back(request);
+        }
+        process_batch(batch);
+    }
+}
+
+void encryption_service::process_batch(const std::vector<service_request*>& batch)
+{
+    thread_pool& pool = default_thread_pool();
+
+    size_t batch_bytes = 0;
+    for (const service_request* request : batch)
+    {
+        batch_bytes += request->length;
+    }
+
+    // each transform is split across the pool when it is large on its own. a batch of small ones is spread
+    // over the pool together when it adds up to enough work, otherwise waking workers would cost more than it saves.
+    auto transform = [&pool](service_request& request) {
+        if (request.op == service_op_transform)
+        {
+            parallel_xor_transform(request.data.data(), request.data.data(), request.length, request.key.data(), request.key.length(),
+                static_cast<size_t>(request.key_offset % request.key.length()), pool);
+        }
+    };
+    if (batch.size() > 1 && batch_bytes >= parallel_chunk_size)
+    {
+        pool.parallel_for(batch.size(), [&](size_t i) { transform(*batch[i]); });
+    }
+    else
+    {
+        for (service_request* request : batch)
+        {
+            transform(*request);
+        }
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    const uint64_t requests_before = requests_;
+    for (service_request* request : batch)
+    {
+        if (request->op == service_op_transform)
+        {
+            ++requests_;
+            bytes_ += request->length;
+            const double latency = std::chrono::duration<double, std::micro>(now - request->received).count();
+            if (latencies_.size() < service_latency_window)
+            {
+                latencies_.push_back(latency);
+            }
+            else
+            {
+                latencies_[latency_next_] = latency;
+                latency_next_ = (latency_next_ + 1) % service_latency_window;
+            }
+        }
+        else
+        { // a shutdown takes effect once its connection has written the report, see serve_connection
+            request->report = format_report();
+        }
+
+        std::lock_guard<std::mutex> lock(request->mutex);
+        request->done = true;
+        request->finished.notify_one();
+    }
+    if (requests_ != requests_before)
+    { // only batches that carried transforms count towards the batching report
+        ++batches_;
+    }
+}
 
 /// <summary>
-/// encrypt or decrypt a source string using the provided key
+/// request counts and the percentiles of the time from a request being received to its result being ready
 /// </summary>
-/// <param name="source">input string to process</param>
-/// <param name="key">key to use in encryption / decryption</param>
-/// <returns>transformed string</returns>
-std::string encrypt_decrypt(const std::string& source, const std::string& key)
+std::string encryption_service::format_report() const
 {
-    // get lengths now instead of calling the function every time.
-    // this would have most likely been inlined by the compiler, but design for perfomance.
-    const auto key_length = key.length();
-    const auto source_length = source.length();
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(1);
+    report << requests_ << " requests, " << bytes_ << " bytes in " << batches_ << " batches ("
+        << (batches_ > 0 ? static_cast<double>(requests_) / static_cast<double>(batches_) : 0.0) << " requests per batch)";
+    if (refused_connections_ > 0)
+    {
+        report << ", " << refused_connections_ << " connections refused at the limit of " << service_max_connections;
+    }
+    if (!latencies_.empty())
+    {
+        std::vector<double> sorted(latencies_);
+        std::sort(sorted.begin(), sorted.end());
+        report << "\nlatency over the last " << sorted.size() << " requests, us: p50 " << percentile(sorted, 0.50) << ", p90 " << percentile(sorted, 0.90)
+            << ", p99 " << percentile(sorted, 0.99) << ", p99.9 " << percentile(sorted, 0.999) << ", max " << sorted.back();
+    }
+    return report.str();
+}
 
-    // assert that our input data is good
-    assert(key_length > 0);
-    assert(source_length > 0);
+/// <summary>
+/// a connection to a running encryption_service
+/// </summary>
+class service_client
+{
+public:
+    service_client() = default;
+    ~service_client() { close(); }
 
-    std::string output = source;
+    service_client(const service_client&) = delete;
+    service_client& operator=(const service_client&) = delete;
 
-    // loop through the source string char by char
-    for (size_t i = 0; i < source_length; ++i)
-    { // TODO: student need to change the next line from output[i] = source[i]
-      // transform each character based on an xor of the key modded constrained to key length using a mod
-        output[i] = source[i] ^ key[i % key_length];
+    bool connect(const std::string& socket_path)
+    {
+        close();
+        sockaddr_un address;
+        if (!make_socket_address(socket_path, address))
+        {
+            return false;
+        }
+        fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd_ < 0 || ::connect(fd_, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+        {
+            close();
+            return false;
+        }
+        // a service that closes the connection, at its connection limit or while stopping, must show up
+        // as a failed request rather than kill the client
+        std::signal(SIGPIPE, SIG_IGN);
+        return true;
     }
 
-    // our output length must equal our source length
-    assert(output.length() == source_length);
+    void close()
+    {
+        if (fd_ >= 0)
+        {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
 
-    // return the transformed string
-    return output;
+    /// <summary>
+    /// encrypt or decrypt length bytes of data on the service, starting the key at key_offset.
+    /// output may be the same buffer as data.
+    /// </summary>
+    bool transform(std::string_view key, uint64_t key_offset, const char* data, size_t length, char* output)
+    {
+        uint64_t response_length = 0;
+        if (!send_request(service_op_transform, key, key_offset, data, length) || !receive_header(response_length) || response_length != length)
+        {
+            return false;
+        }
+        return read_exact(fd_, output, length);
+    }
+
+    /// <summary>
+    /// fetch the service's report. shutdown also stops the service once the report is sent.
+    /// </summary>
+    bool request_report(uint32_t op, std::string& report)
+    {
+        assert(op == service_op_stats || op == service_op_shutdown);
+        uint64_t response_length = 0;
+        if (!send_request(op, std::string_view(), 0, nullptr, 0) || !receive_header(response_length) || response_length > service_max_data_length)
+        {
+            return false;
+        }
+        report.resize(static_cast<size_t>(response_length));
+        return read_exact(fd_, &report[0], report.length());
+    }
+
+private:
+    bool send_request(uint32_t op, std::string_view key, uint64_t key_offset, const char* data, size_t length)
+    {
+        char header[service_request_header_size];
+        store_le32(header, op);
+        store_le32(header + 4, static_cast<uint32_t>(key.length()));
+        store_le32(header + 8, static_cast<uint32_t>(key_offset));
+        store_le32(header + 12, static_cast<uint32_t>(key_offset >> 32));
+        store_le32(header + 16, static_cast<uint32_t>(length));
+        store_le32(header + 20, static_cast<uint32_t>(static_cast<uint64_t>(length) >> 32));
+        iovec parts[3] = {
+            { header, sizeof(header) },
+            { const_cast<char*>(key.data()), key.length() },
+            { const_cast<char*>(data), length },
+        };
+        return fd_ >= 0 && write_exact(fd_, parts, 3);
+    }
+
+    bool receive_header(uint64_t& length)
+    {
+        char header[service_response_header_size];
+        if (!read_exact(fd_, header, sizeof(header)) || get_u32(header) != service_status_ok)
+        {
+            return false;
+        }
+        length = get_u64(header + 8);
+        return true;
+    }
+
+    int fd_ = -1;
+};
+
+/// <summary>
+/// the batch_process_file steps with the transform done by the service instead of in this process
+/// </summary>
+bool service_process_file(service_client& client, const std::string& input_filename, const std::string& output_filename, const std::string& key, bool input_has_header)
+{
+    pooled_buffer file_buffer;
+    if (!read_file_into(input_filename.c_str(), file_buffer))
+    {
+        std::cout << "Failed to read " << input_filename << std::endl;
+        return false;
+    }
+
+    const std::string_view file_data(file_buffer.data(), file_buffer.size());
+    std::string_view student_name = get_student_name_view(file_data);
+    std::string_view body = file_data;
+    if (input_has_header && !split_data_file(file_data, student_name, body))
+    {
+        std::cout << input_filename << " is not a saved data file" << std::endl;
+        return false;
+    }
+
+    // the name may be a view into the body, so format the header before transforming it
+    pooled_buffer header_buffer = default_buffer_pool().acquire(format_data_header(nullptr, 0, student_name, key));
+    format_data_header(header_buffer.data(), header_buffer.size(), student_name, key);
+
+    char* const body_data = file_buffer.data() + (body.data() - file_data.data());
+    if (!client.transform(key, 0, body_data, body.length(), body_data))
+    {
+        std::cout << "The service did not return " << input_filename << std::endl;
+        return false;
+    }
+    return write_data_file(output_filename.c_str(), std::string_view(header_buffer.data(), header_buffer.size()), body);
 }
 
-std::string read_file(const std::string& filename)
+/// <summary>
+/// load the service from several clients at once, each with one request in flight, and report the round
+/// trip latency seen by the clients next to the service's own report
+/// </summary>
+/// <param name="socket_path">socket of a running service</param>
+/// <param name="client_count">concurrent connections</param>
+/// <param name="request_count">requests per connection</param>
+/// <param name="bytes">size of every request</param>
+/// <returns>true when every request came back correct</returns>
+bool run_service_benchmark(const std::string& socket_path, size_t client_count, size_t request_count, size_t bytes)
 {
-    std::string file_text = "John Q. Smith\nThis is my test string";
+    const std::string key = "password";
+    std::vector<char> source(bytes);
+    for (size_t i = 0; i < bytes; ++i)
+    {
+        source[i] = static_cast<char>(i * 131 + 7);
+    }
+    std::vector<char> expected(bytes);
+    xor_transform(source.data(), expected.data(), bytes, key.data(), key.length(), 0);
 
-    // TODO: implement loading the file into a string
-    std::ifstream in(filename);
-    if (in)
+    std::vector<std::vector<double>> latencies(client_count);
+    std::atomic<size_t> failures{ 0 };
+    std::vector<std::thread> clients;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t c = 0; c < client_count; ++c)
     {
-        std::stringstream buffer;
-        buffer << in.rdbuf();
-        file_text = buffer.str();
+        clients.emplace_back([&, c]() {
+            service_client client;
+            if (!client.connect(socket_path))
+            {
+                failures += request_count;
+                return;
+            }
+            std::vector<char> output(bytes);
+            latencies[c].reserve(request_count);
+            for (size_t r = 0; r < request_count; ++r)
+            {
+                const auto sent = std::chrono::steady_clock::now();
+                const bool succeeded = client.transform(key, 0, source.data(), bytes, output.data());
+                latencies[c].push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - sent).count());
+                if (!succeeded || output != expected)
+                {
+                    ++failures;
+                }
+            }
+        });
+    }
+    for (auto& client : clients)
+    {
+        client.join();
     }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-    return file_text;
+    std::vector<double> sorted;
+    for (const auto& client_latencies : latencies)
+    {
+        sorted.insert(sorted.end(), client_latencies.begin(), client_latencies.end());
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << client_count << " clients x " << request_count << " requests of " << bytes << " bytes: "
+        << (seconds > 0.0 ? static_cast<double>(sorted.size()) / seconds : 0.0) << " requests/s, "
+        << megabytes_per_second(sorted.size() * bytes, seconds) << " MB/s, " << failures << " failed" << std::endl;
+    if (!sorted.empty())
+    {
+        std::cout << "round trip us: p50 " << percentile(sorted, 0.50) << ", p90 " << percentile(sorted, 0.90) << ", p99 " << percentile(sorted, 0.99)
+            << ", p99.9 " << percentile(sorted, 0.999) << ", max " << sorted.back() << std::endl;
+    }
+
+    service_client client;
+    std::string report;
+    if (client.connect(socket_path) && client.request_report(service_op_stats, report))
+    {
+        std::cout << "service: " << report << std::endl;
+    }
+    return failures == 0;
 }
 
-std::string get_student_name(const std::string& string_data)
+#endif
+
+// the benchmark suite counts heap allocations through these replacements of the global operators.
+// array forms forward here by default, so they are counted too. the nothrow form is replaced as well, since
+// a sanitizer's own nothrow new would otherwise be paired with the free below. they are kept out of line
+// so the compiler does not pair the inlined malloc and free with the new and delete expressions.
+#if defined(_MSC_VER)
+#define ENCRYPTION_NOINLINE __declspec(noinline)
+#else
+#define ENCRYPTION_NOINLINE __attribute__((noinline))
+#endif
+
+std::atomic<size_t> allocation_count{ 0 };
+
+ENCRYPTION_NOINLINE void* operator new(std::size_t size)
 {
-    std::string student_name;
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size == 0 ? 1 : size))
+    {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
 
-    // find the first newline
-    size_t pos = string_data.find('\n');
-    // did we find a newline
-    if (pos != std::string::npos)
-    { // we did, so copy that substring as the student name
-        student_name = string_data.substr(0, pos);
+ENCRYPTION_NOINLINE void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+ENCRYPTION_NOINLINE void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+ENCRYPTION_NOINLINE void operator delete(void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+/// <summary>
+/// one measured point of the benchmark sweep
+/// </summary>
+struct benchmark_result
+{
+    std::string name;
+    size_t bytes = 0;
+    size_t key_length = 0;
+    bool cold = false;
+    size_t iterations = 0;
+    double seconds = 0.0;
+    uint64_t cycles = 0;
+    size_t allocations = 0;
+    size_t failures = 0;
+};
+
+/// <summary>
+/// cpu timestamp counter. these are reference cycles at the nominal clock, which is what cycles/byte
+/// reports; zero where there is no counter.
+/// </summary>
+inline uint64_t read_cycle_counter()
+{
+#if defined(ENCRYPTION_X86_64)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/// <summary>
+/// push the benchmark data out of every cache level by writing a buffer bigger than the last level cache
+/// </summary>
+void evict_caches()
+{
+    static std::vector<char> eviction_buffer(64 * 1024 * 1024);
+    static char value = 0;
+    ++value;
+    std::memset(eviction_buffer.data(), value, eviction_buffer.size());
+}
+
+/// <summary>
+/// time call() processing bytes. hot runs repeat the call back to back after a warm up, cold runs evict
+/// the caches before every call and time only the call. call returns false when it failed, which is
+/// counted in the result's failures so a broken path is never reported as a plain timing.
+/// </summary>
+/// <param name="max_iterations">upper bound on calls, so slow (file based) benchmarks stay short on tiny inputs</param>
+template <typename Function>
+benchmark_result run_benchmark(const std::string& name, size_t bytes, size_t key_length, bool cold, size_t max_iterations, Function&& call)
+{
+    // enough calls to move about 64 MiB, which steadies the small sizes without dragging out the big ones
+    const size_t target_bytes = 64 * 1024 * 1024;
+    size_t iterations = std::max<size_t>(1, std::min(max_iterations, target_bytes / std::max<size_t>(bytes, 1)));
+    if (cold)
+    { // every cold call pays for an eviction that is not timed, so keep the count low
+        iterations = std::min<size_t>(iterations, 5);
     }
 
-    return student_name;
+    benchmark_result result;
+    result.name = name;
+    result.bytes = bytes;
+    result.key_length = key_length;
+    result.cold = cold;
+    result.iterations = iterations;
+
+    if (!cold)
+    {
+        result.failures += call() ? 0 : 1;
+        const size_t allocations_before = allocation_count.load();
+        const uint64_t cycles_before = read_cycle_counter();
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            result.failures += call() ? 0 : 1;
+        }
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.cycles = read_cycle_counter() - cycles_before;
+        result.allocations = allocation_count.load() - allocations_before;
+    }
+    else
+    {
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            evict_caches();
+            const size_t allocations_before = allocation_count.load();
+            const uint64_t cycles_before = read_cycle_counter();
+            const auto start = std::chrono::steady_clock::now();
+            result.failures += call() ? 0 : 1;
+            result.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            result.cycles += read_cycle_counter() - cycles_before;
+            result.allocations += allocation_count.load() - allocations_before;
+        }
+    }
+    return result;
 }
 
-void save_data_file(const std::string& filename, const std::string& student_name, const std::string& key, const std::string& data)
+/// <summary>
+/// write one result as a JSON object
+/// </summary>
+void write_benchmark_json(std::ostream& out, const benchmark_result& result)
 {
-    //  TODO: implement file saving
-    //  file format
-    //  Line 1: student name
-    //  Line 2: timestamp (yyyy-mm-dd)
-    //  Line 3: key used
-    //  Line 4+: data
+    const double calls = static_cast<double>(result.iterations);
+    const double total_bytes = static_cast<double>(result.bytes) * calls;
+    out << "    {\"name\": \"" << result.name << "\""
+        << ", \"bytes\": " << result.bytes
+        << ", \"key_length\": " << result.key_length
+        << ", \"cache\": \"" << (result.cold ? "cold" : "hot") << "\""
+        << ", \"iterations\": " << result.iterations
+        << ", \"seconds_per_call\": " << result.seconds / calls
+        << ", \"bytes_per_second\": " << (result.seconds > 0.0 ? total_bytes / result.seconds : 0.0)
+        << ", \"cycles_per_byte\": " << (total_bytes > 0.0 ? static_cast<double>(result.cycles) / total_bytes : 0.0)
+        << ", \"allocations_per_call\": " << static_cast<double>(result.allocations) / calls
+        << ", \"failures\": " << result.failures
+        << "}";
+}
 
-    std::ofstream out(filename);
+/// <summary>
+/// create a new directory, named after prefix, under the system temp directory
+/// </summary>
+/// <returns>true when a directory that did not exist before was created</returns>
+bool make_temp_directory(const std::string& prefix, std::filesystem::path& directory)
+{
+    std::error_code error;
+    const std::filesystem::path base = std::filesystem::temp_directory_path(error);
+    if (error)
+    {
+        return false;
+    }
+    // create_directory only reports true for a directory it made, so a name already taken is just skipped
+    const auto seed = static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+    for (uint64_t attempt = 0; attempt < 100; ++attempt)
+    {
+        directory = base / (prefix + std::to_string(seed + attempt));
+        if (std::filesystem::create_directory(directory, error))
+        {
+            return true;
+        }
+    }
+    return false;
+}
 
-    // Line 1: student name
-    out << student_name << '\n';
+/// <summary>
+/// sweep every encryption path over input sizes from 64 bytes to max_bytes (growing 4x per step) and key
+/// lengths from 1 to 4096 bytes, hot and cold, and write the results as JSON. file based paths run
+/// against files in a new directory under the system temp directory, removed afterwards, with the
+/// operating system page cache warm in both modes.
+/// </summary>
+/// <param name="output_filename">JSON file to write</param>
+/// <param name="max_bytes">largest input size</param>
+/// <returns>true when the results were written and no call failed</returns>
+bool run_benchmarks(const std::string& output_filename, size_t max_bytes)
+{
+    std::ofstream out(output_filename);
+    if (!out)
+    {
+        std::cout << "Failed to create " << output_filename << std::endl;
+        return false;
+    }
 
-    // Line 2: timestamp (yyyy-mm-dd)
-    std::time_t t = std::time(nullptr);
-    std::tm tm;
-    localtime_s(&tm, &t);
-    out << std::put_time(&tm, "%Y-%m-%d") << '\n';
+    std::filesystem::path work_directory;
+    if (!make_temp_directory("encryption_benchmark_", work_directory))
+    {
+        std::cout << "Failed to create a temporary directory for the file benchmarks" << std::endl;
+        return false;
+    }
 
-    // Line 3: key used
-    out << key << '\n';
+    std::vector<size_t> sizes;
+    for (size_t size = 64; size <= max_bytes; size *= 4)
+    {
+        sizes.push_back(size);
+    }
+    const size_t key_lengths[] = { 1, 3, 8, 16, 32, 64, 1000, 4096 };
+    const xor_kernel generic_kernel = select_xor_kernel(nullptr);
+    const size_t file_key_length = 8;
+    const size_t file_max_iterations = 1000;
+    const std::string input_filename = (work_directory / "benchmark_input.tmp").string();
 
-    // Line 4+: data
-    out << data;
+    // the fan out series use 8 keys and skip sizes whose outputs would not fit in fan_out_max_bytes
+    std::vector<std::string> fan_out_keys(8);
+    std::vector<std::vector<char>> fan_out_outputs(fan_out_keys.size());
+    std::vector<char*> fan_out_output_data(fan_out_keys.size());
+    const size_t fan_out_max_bytes = size_t(1) << 30;
+    const std::string output_data_filename = (work_directory / "benchmark_output.tmp").string();
+
+    std::string key_material(4096 + 8, '\0');
+    for (size_t i = 0; i < key_material.length(); ++i)
+    {
+        key_material[i] = static_cast<char>('a' + i % 26);
+    }
+
+    std::vector<benchmark_result> results;
+    size_t failures = 0;
+    auto record = [&results, &failures](const benchmark_result& result) {
+        results.push_back(result);
+        failures += result.failures;
+        std::cout << result.name << " " << result.bytes << " bytes, key " << result.key_length << ", "
+            << (result.cold ? "cold" : "hot") << ": "
+            << (result.seconds > 0.0 ? static_cast<double>(result.bytes) * result.iterations / result.seconds / 1.0e6 : 0.0) << " MB/s";
+        if (result.failures > 0)
+        {
+            std::cout << ", " << result.failures << " calls FAILED";
+        }
+        std::cout << std::endl;
+    };
+
+    std::cout << std::fixed << std::setprecision(2);
+    for (size_t size : sizes)
+    {
+        std::string data(size, 'x');
+        for (size_t i = 0; i < size; ++i)
+        {
+            data[i] = static_cast<char>('A' + i % 53);
+        }
+
+        for (bool cold : { false, true })
+        {
+            for (size_t key_length : key_lengths)
+            {
+                const std::string key = key_material.substr(0, key_length);
+                record(run_benchmark("xor_scalar", size, key_length, cold, SIZE_MAX, [&]() {
+                    xor_kernel_scalar(data.data(), &data[0], size, key.data(), key_length, 0);
+                    return true;
+                }));
+                record(run_benchmark("xor_generic", size, key_length, cold, SIZE_MAX, [&]() {
+                    generic_kernel(data.data(), &data[0], size, key.data(), key_length, 0);
+                    return true;
+                }));
+                record(run_benchmark("xor_simd", size, key_length, cold, SIZE_MAX, [&]() {
+                    xor_transform(data.data(), &data[0], size, key.data(), key_length, 0);
+                    return true;
+                }));
+                record(run_benchmark("xor_threaded", size, key_length, cold, SIZE_MAX, [&]() {
+                    parallel_xor_transform(data.data(), &data[0], size, key.data(), key_length, 0, default_thread_pool());
+                    return true;
+                }));
+                record(run_benchmark("encrypt_decrypt", size, key_length, cold, SIZE_MAX, [&]() {
+                    const std::string output = encrypt_decrypt(data, key);
+                    return output.length() == data.length();
+                }));
+
+                // the same keys applied one after another and in a single fan out pass, bytes counts every output
+                if (fan_out_outputs.size() * fan_out_keys.size() * size <= fan_out_max_bytes)
+                {
+                    for (size_t k = 0; k < fan_out_keys.size(); ++k)
+                    {
+                        fan_out_keys[k] = key_material.substr(k, key_length);
+                        fan_out_outputs[k].resize(size);
+                        fan_out_output_data[k] = fan_out_outputs[k].data();
+                    }
+                    record(run_benchmark("xor_per_key", size * fan_out_keys.size(), key_length, cold, SIZE_MAX, [&]() {
+                        for (size_t k = 0; k < fan_out_keys.size(); ++k)
+                        {
+                            parallel_xor_transform(data.data(), fan_out_output_data[k], size, fan_out_keys[k].data(), key_length, 0, default_thread_pool());
+                        }
+                        return true;
+                    }));
+                    record(run_benchmark("xor_fan_out", size * fan_out_keys.size(), key_length, cold, SIZE_MAX, [&]() {
+                        return xor_transform_fan_out(data.data(), size, fan_out_keys.data(), fan_out_output_data.data(), fan_out_keys.size(), default_thread_pool());
+                    }));
+                }
+            }
+
+            // the file paths only differ by key length in the kernel measured above. outputs go to a fresh
+            // file every call: truncating a file that was just written makes some file systems (ext4)
+            // flush it first, which would swamp everything else being measured
+            const std::string key = key_material.substr(0, file_key_length);
+            save_data_file(input_filename, "Benchmark", key, data);
+            // save_data_file cannot report a failure, so check the saved size: header plus data
+            std::error_code size_error;
+            const uintmax_t input_size = std::filesystem::file_size(input_filename, size_error);
+            const bool input_saved = !size_error && input_size > data.length();
+            record(run_benchmark("read_file", size, 0, cold, file_max_iterations, [&]() {
+                const std::string file_data = read_file(input_filename);
+                return input_saved && file_data.length() == input_size;
+            }));
+            record(run_benchmark("read_file_pooled", size, 0, cold, file_max_iterations, [&]() {
+                pooled_buffer file_data;
+                return input_saved && read_file_into(input_filename.c_str(), file_data) && file_data.size() == input_size;
+            }));
+            record(run_benchmark("save_data_file", size, 0, cold, file_max_iterations, [&]() {
+                std::remove(output_data_filename.c_str());
+                save_data_file(output_data_filename, "Benchmark", key, data);
+                std::error_code error;
+                return std::filesystem::file_size(output_data_filename, error) == input_size && !error;
+            }));
+            record(run_benchmark("stream_encrypt", size, file_key_length, cold, file_max_iterations, [&]() {
+                std::remove(output_data_filename.c_str());
+                return input_saved && stream_encrypt_decrypt_file(input_filename, output_data_filename, key, true);
+            }));
+            record(run_benchmark("pipelined_encrypt", size, file_key_length, cold, file_max_iterations, [&]() {
+                std::remove(output_data_filename.c_str());
+                return input_saved && pipelined_encrypt_decrypt_file(input_filename, output_data_filename, key, true);
+            }));
+            record(run_benchmark("mmap_encrypt", size, file_key_length, cold, file_max_iterations, [&]() {
+                std::remove(output_data_filename.c_str());
+                return input_saved && mmap_encrypt_decrypt_file(input_filename, output_data_filename, key, true);
+            }));
+        }
+    }
+    std::error_code remove_error;
+    std::filesystem::remove_all(work_directory, remove_error);
+
+    const char* xor_kernel_name = nullptr;
+    select_xor_kernel(&xor_kernel_name);
+    out << std::setprecision(9);
+    out << "{\n  \"xor_kernel\": \"" << xor_kernel_name << "\",\n  \"threads\": " << default_thread_pool().size()
+        << ",\n  \"failures\": " << failures << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        write_benchmark_json(out, results[i]);
+        out << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+
+    std::cout << "Wrote " << results.size() << " results to " << output_filename;
+    if (failures > 0)
+    {
+        std::cout << ", " << failures << " calls FAILED";
+    }
+    std::cout << std::endl;
+    return static_cast<bool>(out) && failures == 0;
+}
+
+/// <summary>
+/// display the command line options
+/// </summary>
+void print_usage()
+{
+    std::cout << "Usage:" << std::endl;
+    std::cout << "  Encryption [--lock-memory] [--huge-pages] <mode> ...  borrow i/o buffers locked in memory and/or on huge pages" << std::endl;
+    std::cout << "  Encryption [--cipher xor|chacha20] <mode> ...        cipher for the stream, pipeline and mmap modes, default xor." << std::endl;
+    std::cout << "                                                      a chacha20 key is 64 hex digits of key then 24 of nonce" << std::endl;
+    std::cout << "  Encryption                                          run the inputdatafile.txt round trip test" << std::endl;
+    std::cout << "  Encryption --stream-encrypt <input> <output> [key]  encrypt a file of any size in fixed memory" << std::endl;
+    std::cout << "  Encryption --stream-decrypt <input> <output> [key]  decrypt a saved data file in fixed memory" << std::endl;
+    std::cout << "  Encryption --pipeline-encrypt <input> <output> [key] encrypt with reading, encrypting and writing overlapped" << std::endl;
+    std::cout << "  Encryption --pipeline-decrypt <input> <output> [key] decrypt with reading, decrypting and writing overlapped" << std::endl;
+    std::cout << "  Encryption --mmap-encrypt <input> <output> [key]    encrypt a file through memory mapped pages" << std::endl;
+    std::cout << "  Encryption --mmap-decrypt <input> <output> [key]    decrypt a saved data file through memory mapped pages" << std::endl;
+    std::cout << "  Encryption --container-encrypt <input> <output> [key] encrypt into the indexed binary container" << std::endl;
+    std::cout << "  Encryption --container-encrypt-compressed <input> <output> [key] compress each chunk, then encrypt into the container" << std::endl;
+    std::cout << "  Encryption --container-decrypt <input> <output> [key] decrypt a container or text data file" << std::endl;
+    std::cout << "  Encryption --container-info <container>              show a container's header and chunk table" << std::endl;
+    std::cout << "  Encryption --decrypt-range <file> <begin> <end> [key]  decrypt body bytes [begin, end) of a data file or container to stdout" << std::endl;
+    std::cout << "  Encryption --cipher-report                           check ChaCha20 against RFC 8439 and report GB/s per cipher engine" << std::endl;
+    std::cout << "  Encryption --benchmark <results.json> [max bytes]    sweep every path over sizes and key lengths, default up to 4 GiB" << std::endl;
+    std::cout << "  Encryption --serve <socket>                          run the resident encryption service on a unix domain socket" << std::endl;
+    std::cout << "  Encryption --service-encrypt <socket> <input> <output> [key]  encrypt a file through the running service" << std::endl;
+    std::cout << "  Encryption --service-decrypt <socket> <input> <output> [key]  decrypt a saved data file through the running service" << std::endl;
+    std::cout << "  Encryption --service-bench <socket> <clients> <requests> [bytes]  load the service and report round trip percentiles" << std::endl;
+    std::cout << "  Encryption --service-stats <socket>                  show the service's request counts and latency percentiles" << std::endl;
+    std::cout << "  Encryption --service-stop <socket>                   shut the service down" << std::endl;
+    std::cout << "  Encryption --fan-out-encrypt <input> <output prefix> <key> [key ...]  read once, encrypt under every key, save <output prefix>.1, .2, ..." << std::endl;
+    std::cout << "  Encryption --batch-encrypt <directory|manifest> <output directory> [key]  encrypt many files on a worker pool" << std::endl;
+    std::cout << "  Encryption --batch-decrypt <directory|manifest> <output directory> [key]  decrypt many saved data files on a worker pool" << std::endl;
+}
+
+/// <summary>
+/// run one of the command line modes
+/// </summary>
+/// <returns>process exit code</returns>
+int run_mode(int argc, char* argv[])
+{
+    const std::string mode = argv[1];
+    const std::string default_key = "password";
+
+    // buffer pool options come before the mode
+    if ((mode == "--lock-memory" || mode == "--huge-pages") && argc > 2)
+    {
+        if (mode == "--lock-memory")
+        {
+            default_buffer_pool_settings().lock_memory = true;
+        }
+        else
+        {
+            default_buffer_pool_settings().huge_pages = true;
+        }
+        return run_mode(argc - 1, argv + 1);
+    }
+
+    // the cipher option also comes before the mode
+    if (mode == "--cipher" && argc > 3)
+    {
+        const std::string name = argv[2];
+        if (name != "xor" && name != "chacha20")
+        {
+            std::cout << "Unknown cipher " << name << ", expected xor or chacha20" << std::endl;
+            return -1;
+        }
+        default_cipher_settings().name = name;
+        return run_mode(argc - 2, argv + 2);
+    }
+
+    // only the modes that take their transform from make_cipher_engine can run another cipher
+    const bool engine_mode = mode.compare(0, 9, "--stream-") == 0 || mode.compare(0, 11, "--pipeline-") == 0 || mode.compare(0, 7, "--mmap-") == 0;
+    if (default_cipher_settings().name != "xor" && !engine_mode)
+    {
+        std::cout << "Only the stream, pipeline and mmap modes can use the " << default_cipher_settings().name << " cipher" << std::endl;
+        return -1;
+    }
+
+    if (mode == "--cipher-report" && argc == 2)
+    {
+        return run_cipher_report() ? 0 : -1;
+    }
+
+    if (mode == "--benchmark" && (argc == 3 || argc == 4))
+    {
+        size_t max_bytes = size_t(4) * 1024 * 1024 * 1024;
+        try
+        {
+            if (argc == 4)
+            {
+                max_bytes = static_cast<size_t>(std::stoull(argv[3]));
+            }
+        }
+        catch (const std::exception& ex)
+        {
+            std::cout << "The maximum size must be a byte count: " << ex.what() << std::endl;
+            return -1;
+        }
+        return run_benchmarks(argv[2], max_bytes) ? 0 : -1;
+    }
+
+#if defined(_WIN32)
+    if (mode == "--serve" || mode.compare(0, 10, "--service-") == 0)
+    {
+        std::cout << "The service modes need unix domain sockets, which this build does not support." << std::endl;
+        return -1;
+    }
+#else
+    if (mode == "--serve" && argc == 3)
+    {
+        encryption_service service;
+        return service.run(argv[2]) ? 0 : -1;
+    }
+
+    if ((mode == "--service-stats" || mode == "--service-stop") && argc == 3)
+    {
+        service_client client;
+        std::string report;
+        if (!client.connect(argv[2]) || !client.request_report(mode == "--service-stop" ? service_op_shutdown : service_op_stats, report))
+        {
+            std::cout << "No service is answering on " << argv[2] << std::endl;
+            return -1;
+        }
+        std::cout << report << std::endl;
+        return 0;
+    }
+
+    if ((mode == "--service-encrypt" || mode == "--service-decrypt") && (argc == 5 || argc == 6))
+    {
+        const std::string key = argc == 6 ? argv[5] : default_key;
+        service_client client;
+        if (key.empty())
+        {
+            std::cout << "The key must not be empty." << std::endl;
+            return -1;
+        }
+        if (!client.connect(argv[2]))
+        {
+            std::cout << "No service is answering on " << argv[2] << std::endl;
+            return -1;
+        }
+        return service_process_file(client, argv[3], argv[4], key, mode == "--service-decrypt") ? 0 : -1;
+    }
+
+    if (mode == "--service-bench" && (argc == 5 || argc == 6))
+    {
+        size_t client_count = 0;
+        size_t request_count = 0;
+        size_t bytes = 4096;
+        try
+        {
+            client_count = static_cast<size_t>(std::stoull(argv[3]));
+            request_count = static_cast<size_t>(std::stoull(argv[4]));
+            if (argc == 6)
+            {
+                bytes = static_cast<size_t>(std::stoull(argv[5]));
+            }
+        }
+        catch (const std::exception& ex)
+        {
+            std::cout << "Clients, requests and bytes must be counts: " << ex.what() << std::endl;
+            return -1;
+        }
+        return run_service_benchmark(argv[2], client_count, request_count, bytes) ? 0 : -1;
+    }
+#endif
+
+    if (mode == "--fan-out-encrypt" && argc >= 5)
+    {
+        const std::vector<std::string> keys(argv + 4, argv + argc);
+        if (std::find(keys.begin(), keys.end(), std::string()) != keys.end())
+        {
+            std::cout << "The key must not be empty." << std::endl;
+            return -1;
+        }
+        return fan_out_encrypt_file(argv[2], argv[3], keys) ? 0 : -1;
+    }
+
+    if (mode == "--container-info" && argc == 3)
+    {
+        return print_container_info(argv[2]) ? 0 : -1;
+    }
+
+    if (mode == "--decrypt-range" && (argc == 5 || argc == 6))
+    {
+        const std::string key = argc == 6 ? argv[5] : default_key;
+        uint64_t begin = 0;
+        uint64_t end = 0;
+        try
+        {
+            begin = std::stoull(argv[3]);
+            end = std::stoull(argv[4]);
+        }
+        catch (const std::exception& ex)
+        {
+            std::cout << "The range must be two byte offsets: " << ex.what() << std::endl;
+            return -1;
+        }
+        std::string range;
+        if (key.empty() || !decrypt_range(argv[2], key, begin, end, range))
+        {
+            std::cout << "Failed to decrypt the requested range of " << argv[2] << std::endl;
+            return -1;
+        }
+        std::cout.write(range.data(), range.length());
+        return 0;
+    }
+
+    if (argc != 4 && argc != 5)
+    {
+        print_usage();
+        return -1;
+    }
+
+    // every file mode takes <input> <output> [key], batch modes take a directory or manifest and an output directory
+    const std::string input_filename = argv[2];
+    const std::string output_filename = argv[3];
+    const std::string key = argc == 5 ? argv[4] : default_key;
+    if (key.empty())
+    {
+        std::cout << "The key must not be empty." << std::endl;
+        return -1;
+    }
+    if (make_cipher_engine(key) == nullptr)
+    {
+        std::cout << "A chacha20 key is 64 hex digits of key followed by 24 hex digits of nonce." << std::endl;
+        return -1;
+    }
+
+    if (mode == "--stream-encrypt" || mode == "--stream-decrypt")
+    {
+        return stream_encrypt_decrypt_file(input_filename, output_filename, key, mode == "--stream-decrypt") ? 0 : -1;
+    }
+
+    if (mode == "--pipeline-encrypt" || mode == "--pipeline-decrypt")
+    {
+        return pipelined_encrypt_decrypt_file(input_filename, output_filename, key, mode == "--pipeline-decrypt") ? 0 : -1;
+    }
+
+    if (mode == "--mmap-encrypt" || mode == "--mmap-decrypt")
+    {
+        return mmap_encrypt_decrypt_file(input_filename, output_filename, key, mode == "--mmap-decrypt") ? 0 : -1;
+    }
+
+    if (mode == "--container-encrypt" || mode == "--container-encrypt-compressed")
+    {
+        const uint32_t codec = mode == "--container-encrypt-compressed" ? container_codec_lz : container_codec_none;
+        return container_encrypt_file(input_filename, output_filename, key, static_cast<uint32_t>(stream_chunk_size), codec) ? 0 : -1;
+    }
+
+    if (mode == "--container-decrypt")
+    {
+        return container_decrypt_file(input_filename, output_filename, key) ? 0 : -1;
+    }
+
+    if (mode == "--batch-encrypt" || mode == "--batch-decrypt")
+    {
+        return batch_encrypt_decrypt(input_filename, output_filename, key, mode == "--batch-decrypt") ? 0 : -1;
+    }
+
+    print_usage();
+    return -1;
 }
 
-int main()
+int main(int argc, char* argv[])
 {
+    if (argc > 1)
+    { // a mode was asked for on the command line
+        return run_mode(argc, argv);
+    }
+
     std::cout << "Encyption Decryption Test!" << std::endl;
 
     // input file format